@@ -0,0 +1,172 @@
+/*    This file is part of cpp-utils
+ *    Copyright (c) 2010 Victor Vicente de Carvalho <victor.v.carvalho@gmail.com>
+ *
+ *    cpp-utils is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    cpp-utils is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with corvogame.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *    Spawn and steal throughput of the executors: a flat fan-out of empty
+ *    tasks from one thread (everything is stolen) and a recursive fib
+ *    (mostly local pushes and pops, stealing near the root).
+ *
+ *    g++ -O2 -std=c++14 -I../include executor_bench.cpp -o executor_bench -pthread
+ *
+ *    With a TBB that still has tbb/task.h, add the legacy backend:
+ *    g++ -O2 -std=c++14 -I../include -DCPP_UTILS_USE_TBB executor_bench.cpp -o executor_bench -ltbb -pthread
+ *
+ *    With any TBB, add tbb::task_group as a reference point:
+ *    g++ -O2 -std=c++14 -I../include -DBENCH_TASK_GROUP executor_bench.cpp -o executor_bench -ltbb -pthread
+ *
+ *    Add -DCPP_UTILS_TRACE to see what the tracing hooks cost (three events
+ *    per task).
+ */
+
+#include "parallell.hpp"
+#include "native_executor.hpp"
+
+#ifdef BENCH_TASK_GROUP
+#include <tbb/task_group.h>
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+
+namespace
+{
+
+typedef std::chrono::steady_clock bench_clock;
+
+double seconds_since(bench_clock::time_point start)
+{
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+double fan_out(cpp_utils::executor& exec, unsigned int spawns)
+{
+    std::atomic<unsigned int> sink(0);
+    bench_clock::time_point start = bench_clock::now();
+
+    {
+        cpp_utils::synched_t synch(cpp_utils::synched_t::join_auto, cpp_utils::synched_t::error_continue, exec);
+
+        for (unsigned int i = 0; i < spawns; ++i)
+            cpp_utils::parallel(synch, [&sink] { sink.fetch_add(1, std::memory_order_relaxed); });
+
+        synch.wait_for_all();
+    }
+
+    return spawns / seconds_since(start);
+}
+
+long fib(cpp_utils::executor& exec, int n)
+{
+    if (n < 2)
+        return n;
+
+    long x = 0;
+    long y = 0;
+
+    {
+        cpp_utils::synched_t synch(cpp_utils::synched_t::join_help, cpp_utils::synched_t::error_continue, exec);
+        cpp_utils::parallel(synch, [&exec, &x, n] { x = fib(exec, n - 1); });
+        y = fib(exec, n - 2);
+        synch.wait_for_all();
+    }
+
+    return x + y;
+}
+
+// fib(n) spawns fib(n + 1) - 1 tasks.
+double fib_rate(cpp_utils::executor& exec, int n)
+{
+    long tasks = 0;
+    bench_clock::time_point start = bench_clock::now();
+
+    {
+        cpp_utils::synched_t synch(cpp_utils::synched_t::join_auto, cpp_utils::synched_t::error_continue, exec);
+        cpp_utils::parallel(synch, [&exec, &tasks, n] { tasks = fib(exec, n + 1) - 1; });
+        synch.wait_for_all();
+    }
+
+    return tasks / seconds_since(start);
+}
+
+void report(const char* name, cpp_utils::executor& exec, unsigned int spawns, int depth)
+{
+    // First round warms up the workers and the free lists.
+    fan_out(exec, spawns);
+    std::printf("%-16s fan-out %12.0f tasks/sec   fib %12.0f tasks/sec\n", name,
+            fan_out(exec, spawns), fib_rate(exec, depth));
+}
+
+#ifdef BENCH_TASK_GROUP
+long group_fib(int n)
+{
+    if (n < 2)
+        return n;
+
+    long x = 0;
+    long y = 0;
+    tbb::task_group group;
+
+    group.run([&x, n] { x = group_fib(n - 1); });
+    y = group_fib(n - 2);
+    group.wait();
+
+    return x + y;
+}
+
+void report_task_group(unsigned int spawns, int depth)
+{
+    std::atomic<unsigned int> sink(0);
+    bench_clock::time_point start = bench_clock::now();
+
+    {
+        tbb::task_group group;
+
+        for (unsigned int i = 0; i < spawns; ++i)
+            group.run([&sink] { sink.fetch_add(1, std::memory_order_relaxed); });
+
+        group.wait();
+    }
+
+    double flat = spawns / seconds_since(start);
+
+    start = bench_clock::now();
+    long tasks = group_fib(depth + 1) - 1;
+
+    std::printf("%-16s fan-out %12.0f tasks/sec   fib %12.0f tasks/sec\n", "tbb::task_group",
+            flat, tasks / seconds_since(start));
+}
+#endif
+
+} // namespace
+
+int main()
+{
+    const unsigned int spawns = 1000000;
+    const int depth = 25;
+
+    report("native", cpp_utils::native_executor::instance(), spawns, depth);
+
+#ifdef CPP_UTILS_USE_TBB
+    report("tbb::task", cpp_utils::tbb_executor::instance(), spawns, depth);
+#endif
+
+#ifdef BENCH_TASK_GROUP
+    report_task_group(spawns, depth);
+#endif
+
+    return 0;
+}
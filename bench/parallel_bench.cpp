@@ -0,0 +1,672 @@
+/*    This file is part of cpp-utils
+ *    Copyright (c) 2010 Victor Vicente de Carvalho <victor.v.carvalho@gmail.com>
+ *
+ *    cpp-utils is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    cpp-utils is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with corvogame.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *    Spawn, join and fan-out/fan-in suite, for tracking regressions. For
+ *    1, 2, 4 ... hardware threads it measures:
+ *
+ *      spawn_latency     median ns from the spawning call to the body starting
+ *      throughput        tasks/sec, spawning from one thread and joining
+ *      fan_in            ns to spawn width empty tasks and join them
+ *      join_wakeup       ns from the last task of a fan-out finishing to the
+ *                        join returning
+ *      fib               tasks/sec of a recursive fork/join
+ *      reduce            elements/sec of a parallel sum
+ *
+ *    for every spawning overload of parallel (and spawn, parallel_batch,
+ *    strand, synched_tree_t), next to plain std::thread and std::async and,
+ *    when built for them, OpenMP tasks and tbb::task_group. Results go to
+ *    stdout (or the file named on the command line) as a JSON array of
+ *    { impl, overload, threads, metric, value, unit } records.
+ *
+ *    g++ -O2 -std=c++14 -I../include parallel_bench.cpp -o parallel_bench -pthread
+ *
+ *    Add -fopenmp for OpenMP, and -DBENCH_TASK_GROUP ... -ltbb for TBB.
+ */
+
+#include "parallell.hpp"
+#include "native_executor.hpp"
+#include "strand.hpp"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef BENCH_TASK_GROUP
+#include <tbb/parallel_reduce.h>
+#include <tbb/blocked_range.h>
+#include <tbb/task_arena.h>
+#include <tbb/task_group.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <future>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+typedef std::chrono::steady_clock bench_clock;
+
+std::int64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now().time_since_epoch()).count();
+}
+
+double seconds_since(bench_clock::time_point start)
+{
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+// On a machine with fewer cores than threads a busy wait would hold the
+// core the awaited task needs.
+template <typename predicate_t>
+void spin_until(predicate_t done)
+{
+    while (!done())
+        std::this_thread::yield();
+}
+
+double median(std::vector<double> samples)
+{
+    std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+    return samples[samples.size() / 2];
+}
+
+const unsigned int latency_rounds = 1000;
+const unsigned int throughput_tasks = 200000;
+const unsigned int thread_tasks = 2000;
+const int fib_depth = 22;
+const std::size_t reduce_size = 1 << 22;
+const unsigned int fan_widths[] = { 1, 4, 16, 64, 256, 1024 };
+
+struct record
+{
+    std::string m_impl;
+    std::string m_overload;
+    unsigned int m_threads;
+    std::string m_metric;
+    double m_value;
+    std::string m_unit;
+};
+
+class results
+{
+public:
+    void add(const std::string& impl, const std::string& overload, unsigned int threads,
+            const std::string& metric, double value, const std::string& unit)
+    {
+        record r = { impl, overload, threads, metric, value, unit };
+        m_records.push_back(r);
+        std::fprintf(stderr, "%-10s %-28s %2u %-22s %14.1f %s\n", impl.c_str(), overload.c_str(), threads,
+                metric.c_str(), value, unit.c_str());
+    }
+
+    void write(std::FILE* out) const
+    {
+        std::fprintf(out, "[\n");
+
+        for (std::size_t i = 0; i < m_records.size(); ++i)
+        {
+            const record& r = m_records[i];
+            std::fprintf(out, "  {\"impl\": \"%s\", \"overload\": \"%s\", \"threads\": %u, \"metric\": \"%s\", "
+                    "\"value\": %.3f, \"unit\": \"%s\"}%s\n", r.m_impl.c_str(), r.m_overload.c_str(), r.m_threads,
+                    r.m_metric.c_str(), r.m_value, r.m_unit.c_str(), i + 1 < m_records.size() ? "," : "");
+        }
+
+        std::fprintf(out, "]\n");
+    }
+
+private:
+    std::vector<record> m_records;
+};
+
+/*
+ * Everything the cpp_utils overloads spawn into, on one pool. Every body
+ * bumps m_done, so joining is waiting for the groups and then for the
+ * count, whichever overload was used.
+ */
+struct context
+{
+    explicit context(cpp_utils::executor& exec)
+            : m_synch(cpp_utils::synched_t::join_auto, cpp_utils::synched_t::error_continue, exec),
+              m_tree(cpp_utils::synched_t::join_auto, cpp_utils::synched_t::error_continue, exec),
+              m_limit(1 << 16, cpp_utils::admission_limit::admit_block, exec), m_strand(exec), m_done(0)
+    {
+    }
+
+    void join(unsigned long expected)
+    {
+        m_synch.wait_for_all();
+        m_tree.wait_for_all();
+        spin_until([this, expected] { return m_done.load(std::memory_order_acquire) >= expected; });
+        m_done.store(0, std::memory_order_relaxed);
+    }
+
+    cpp_utils::synched_t m_synch;
+    cpp_utils::synched_tree_t m_tree;
+    cpp_utils::admission_limit m_limit;
+    cpp_utils::strand m_strand;
+    std::atomic<unsigned long> m_done;
+};
+
+// One spawning overload: spawn(ctx, count, body) starts count tasks that
+// each call body(index).
+struct overload
+{
+    const char* mp_name;
+    void (*mp_spawn)(context& ctx, unsigned int count, void (*body)(context&, unsigned int));
+};
+
+typedef void (*body_t)(context&, unsigned int);
+
+const overload overloads[] = {
+    { "parallel(f)", [](context& ctx, unsigned int count, body_t body) {
+        for (unsigned int i = 0; i < count; ++i)
+            cpp_utils::parallel([&ctx, body, i] { body(ctx, i); });
+    } },
+    { "parallel(f, args)", [](context& ctx, unsigned int count, body_t body) {
+        for (unsigned int i = 0; i < count; ++i)
+            cpp_utils::parallel([&ctx, body](unsigned int index) { body(ctx, index); }, i);
+    } },
+    { "parallel(synch, f)", [](context& ctx, unsigned int count, body_t body) {
+        for (unsigned int i = 0; i < count; ++i)
+            cpp_utils::parallel(ctx.m_synch, [&ctx, body, i] { body(ctx, i); });
+    } },
+    { "parallel(synch, f, args)", [](context& ctx, unsigned int count, body_t body) {
+        for (unsigned int i = 0; i < count; ++i)
+            cpp_utils::parallel(ctx.m_synch, [&ctx, body](unsigned int index) { body(ctx, index); }, i);
+    } },
+    { "parallel(priority, synch, f)", [](context& ctx, unsigned int count, body_t body) {
+        for (unsigned int i = 0; i < count; ++i)
+            cpp_utils::parallel(cpp_utils::priority_high, ctx.m_synch, [&ctx, body, i] { body(ctx, i); });
+    } },
+    { "parallel(placement, synch, f)", [](context& ctx, unsigned int count, body_t body) {
+        for (unsigned int i = 0; i < count; ++i)
+            cpp_utils::parallel(cpp_utils::placement::on_node(0), ctx.m_synch, [&ctx, body, i] { body(ctx, i); });
+    } },
+    { "parallel(limit, f)", [](context& ctx, unsigned int count, body_t body) {
+        for (unsigned int i = 0; i < count; ++i)
+            cpp_utils::parallel(ctx.m_limit, [&ctx, body, i] { body(ctx, i); });
+    } },
+    { "parallel(tree, f)", [](context& ctx, unsigned int count, body_t body) {
+        for (unsigned int i = 0; i < count; ++i)
+            cpp_utils::parallel(ctx.m_tree, [&ctx, body, i] { body(ctx, i); });
+    } },
+    { "parallel_batch(synch, n, f)", [](context& ctx, unsigned int count, body_t body) {
+        cpp_utils::parallel_batch(ctx.m_synch, count, [&ctx, body](std::size_t i) { body(ctx, unsigned(i)); });
+    } },
+    { "spawn(f)", [](context& ctx, unsigned int count, body_t body) {
+        for (unsigned int i = 0; i < count; ++i)
+            cpp_utils::spawn([&ctx, body, i] { body(ctx, i); });
+    } },
+    { "strand.post(f)", [](context& ctx, unsigned int count, body_t body) {
+        for (unsigned int i = 0; i < count; ++i)
+            ctx.m_strand.post([&ctx, body, i] { body(ctx, i); });
+    } },
+};
+
+std::atomic<std::int64_t> g_started(0);
+
+void count_body(context& ctx, unsigned int)
+{
+    ctx.m_done.fetch_add(1, std::memory_order_release);
+}
+
+void stamp_body(context& ctx, unsigned int)
+{
+    g_started.store(now_ns(), std::memory_order_relaxed);
+    ctx.m_done.fetch_add(1, std::memory_order_release);
+}
+
+std::atomic<std::int64_t> g_last_finish(0);
+std::atomic<unsigned int> g_fan_remaining(0);
+
+void fan_body(context& ctx, unsigned int)
+{
+    if (g_fan_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        g_last_finish.store(now_ns(), std::memory_order_relaxed);
+    ctx.m_done.fetch_add(1, std::memory_order_release);
+}
+
+void bench_overloads(results& out, cpp_utils::executor& exec, unsigned int threads)
+{
+    context ctx(exec);
+
+    for (const overload& o : overloads)
+    {
+        std::vector<double> samples;
+
+        for (unsigned int round = 0; round < latency_rounds; ++round)
+        {
+            g_started.store(0, std::memory_order_relaxed);
+            std::int64_t start = now_ns();
+            o.mp_spawn(ctx, 1, stamp_body);
+            ctx.join(1);
+            samples.push_back(double(g_started.load(std::memory_order_relaxed) - start));
+        }
+
+        out.add("cpp_utils", o.mp_name, threads, "spawn_latency", median(samples), "ns");
+
+        // First round warms up the workers and the free lists.
+        for (int round = 0; round < 2; ++round)
+        {
+            bench_clock::time_point start = bench_clock::now();
+            o.mp_spawn(ctx, throughput_tasks, count_body);
+            ctx.join(throughput_tasks);
+
+            if (round == 1)
+                out.add("cpp_utils", o.mp_name, threads, "throughput", throughput_tasks / seconds_since(start), "tasks/s");
+        }
+
+        for (unsigned int width : fan_widths)
+        {
+            std::vector<double> fan_in;
+            std::vector<double> wakeup;
+
+            for (unsigned int round = 0; round < 50; ++round)
+            {
+                g_fan_remaining.store(width, std::memory_order_relaxed);
+                std::int64_t start = now_ns();
+                o.mp_spawn(ctx, width, fan_body);
+                ctx.join(width);
+                std::int64_t end = now_ns();
+
+                fan_in.push_back(double(end - start));
+                wakeup.push_back(double(end - g_last_finish.load(std::memory_order_relaxed)));
+            }
+
+            std::string metric = "fan_in/" + std::to_string(width);
+            out.add("cpp_utils", o.mp_name, threads, metric, median(fan_in), "ns");
+            out.add("cpp_utils", o.mp_name, threads, "join_wakeup/" + std::to_string(width), median(wakeup), "ns");
+        }
+    }
+}
+
+long fib(int n)
+{
+    if (n < 2)
+        return n;
+
+    long x = 0;
+    long y = 0;
+
+    cpp_utils::synched_t synch(cpp_utils::synched_t::join_help);
+    cpp_utils::parallel(synch, [&x, n] { x = fib(n - 1); });
+    y = fib(n - 2);
+    synch.wait_for_all();
+
+    return x + y;
+}
+
+void bench_nested(results& out, unsigned int threads, const std::vector<double>& data)
+{
+    // fib(n) spawns fib(n + 1) - 1 tasks.
+    long tasks = 0;
+    bench_clock::time_point start = bench_clock::now();
+
+    {
+        cpp_utils::synched_t synch;
+        cpp_utils::parallel(synch, [&tasks] { tasks = fib(fib_depth + 1) - 1; });
+        synch.wait_for_all();
+    }
+
+    out.add("cpp_utils", "synched_t join_help", threads, "fib", tasks / seconds_since(start), "tasks/s");
+
+    start = bench_clock::now();
+    double sum = cpp_utils::parallel_reduce(std::size_t(0), data.size(), 0.0,
+            [&data](std::size_t i) { return data[i]; }, [](double a, double b) { return a + b; });
+    double elapsed = seconds_since(start);
+
+    if (sum != double(data.size()))
+        std::fprintf(stderr, "parallel_reduce: wrong sum %f\n", sum);
+
+    out.add("cpp_utils", "parallel_reduce", threads, "reduce", data.size() / elapsed, "elements/s");
+}
+
+typedef std::function<void()> task_fn;
+
+// Plain threads: one per task, so only the small counts are run.
+template <typename launch_t, typename wait_t>
+void bench_baseline(results& out, const char* impl, unsigned int threads, launch_t launch, wait_t wait)
+{
+    std::vector<double> samples;
+
+    for (unsigned int round = 0; round < 200; ++round)
+    {
+        std::atomic<std::int64_t> started(0);
+        std::int64_t start = now_ns();
+        auto handle = launch([&started] { started.store(now_ns(), std::memory_order_relaxed); });
+        wait(handle);
+        samples.push_back(double(started.load() - start));
+    }
+
+    out.add(impl, impl, threads, "spawn_latency", median(samples), "ns");
+
+    std::atomic<unsigned int> done(0);
+    bench_clock::time_point start = bench_clock::now();
+
+    {
+        std::vector<decltype(launch(task_fn()))> handles;
+
+        for (unsigned int i = 0; i < thread_tasks; ++i)
+            handles.push_back(launch([&done] { done.fetch_add(1, std::memory_order_relaxed); }));
+        for (auto& handle : handles)
+            wait(handle);
+    }
+
+    out.add(impl, impl, threads, "throughput", thread_tasks / seconds_since(start), "tasks/s");
+
+    for (unsigned int width : fan_widths)
+    {
+        std::vector<double> fan_in;
+
+        for (unsigned int round = 0; round < 10; ++round)
+        {
+            std::vector<decltype(launch(task_fn()))> handles;
+            std::int64_t begin = now_ns();
+
+            for (unsigned int i = 0; i < width; ++i)
+                handles.push_back(launch([&done] { done.fetch_add(1, std::memory_order_relaxed); }));
+            for (auto& handle : handles)
+                wait(handle);
+
+            fan_in.push_back(double(now_ns() - begin));
+        }
+
+        out.add(impl, impl, threads, "fan_in/" + std::to_string(width), median(fan_in), "ns");
+    }
+}
+
+// One slice per thread, summed by the launching thread.
+template <typename launch_t, typename wait_t>
+void bench_baseline_reduce(results& out, const char* impl, unsigned int threads, const std::vector<double>& data,
+        launch_t launch, wait_t wait)
+{
+    std::vector<double> partial(threads, 0.0);
+    bench_clock::time_point start = bench_clock::now();
+
+    {
+        std::vector<decltype(launch(task_fn()))> handles;
+        std::size_t slice = (data.size() + threads - 1) / threads;
+
+        for (unsigned int t = 0; t < threads; ++t)
+        {
+            handles.push_back(launch([&data, &partial, slice, t] {
+                std::size_t begin = std::min(data.size(), t * slice);
+                std::size_t end = std::min(data.size(), begin + slice);
+                partial[t] = std::accumulate(data.begin() + begin, data.begin() + end, 0.0);
+            }));
+        }
+
+        for (auto& handle : handles)
+            wait(handle);
+    }
+
+    double sum = std::accumulate(partial.begin(), partial.end(), 0.0);
+    double elapsed = seconds_since(start);
+
+    if (sum != double(data.size()))
+        std::fprintf(stderr, "%s: wrong sum %f\n", impl, sum);
+
+    out.add(impl, impl, threads, "reduce", data.size() / elapsed, "elements/s");
+}
+
+void bench_std(results& out, unsigned int threads, const std::vector<double>& data)
+{
+    auto thread_launch = [](task_fn f) { return std::thread(f); };
+    auto thread_wait = [](std::thread& t) { t.join(); };
+    auto async_launch = [](task_fn f) { return std::async(std::launch::async, f); };
+    auto async_wait = [](std::future<void>& f) { f.get(); };
+
+    bench_baseline(out, "std::thread", threads, thread_launch, thread_wait);
+    bench_baseline_reduce(out, "std::thread", threads, data, thread_launch, thread_wait);
+    bench_baseline(out, "std::async", threads, async_launch, async_wait);
+    bench_baseline_reduce(out, "std::async", threads, data, async_launch, async_wait);
+}
+
+#ifdef _OPENMP
+long omp_fib(int n)
+{
+    if (n < 2)
+        return n;
+
+    long x = 0;
+    long y = 0;
+
+#pragma omp task shared(x)
+    x = omp_fib(n - 1);
+    y = omp_fib(n - 2);
+#pragma omp taskwait
+
+    return x + y;
+}
+
+void bench_openmp(results& out, unsigned int threads, const std::vector<double>& data)
+{
+    const char* impl = "openmp";
+    std::vector<double> samples;
+    double throughput = 0;
+    std::vector<std::vector<double> > fan_in(sizeof(fan_widths) / sizeof(fan_widths[0]));
+    long tasks = 0;
+    double fib_seconds = 0;
+
+#pragma omp parallel num_threads(threads)
+#pragma omp single
+    {
+        for (unsigned int round = 0; round < latency_rounds; ++round)
+        {
+            std::atomic<std::int64_t> started(0);
+            std::int64_t start = now_ns();
+
+#pragma omp task shared(started)
+            started.store(now_ns(), std::memory_order_relaxed);
+#pragma omp taskwait
+
+            samples.push_back(double(started.load() - start));
+        }
+
+        std::atomic<unsigned int> done(0);
+        bench_clock::time_point start = bench_clock::now();
+
+        for (unsigned int i = 0; i < throughput_tasks; ++i)
+        {
+#pragma omp task shared(done)
+            done.fetch_add(1, std::memory_order_relaxed);
+        }
+#pragma omp taskwait
+
+        throughput = throughput_tasks / seconds_since(start);
+
+        for (std::size_t w = 0; w < fan_in.size(); ++w)
+        {
+            for (unsigned int round = 0; round < 50; ++round)
+            {
+                std::int64_t begin = now_ns();
+
+                for (unsigned int i = 0; i < fan_widths[w]; ++i)
+                {
+#pragma omp task shared(done)
+                    done.fetch_add(1, std::memory_order_relaxed);
+                }
+#pragma omp taskwait
+
+                fan_in[w].push_back(double(now_ns() - begin));
+            }
+        }
+
+        start = bench_clock::now();
+        tasks = omp_fib(fib_depth + 1) - 1;
+        fib_seconds = seconds_since(start);
+    }
+
+    out.add(impl, "omp task", threads, "spawn_latency", median(samples), "ns");
+    out.add(impl, "omp task", threads, "throughput", throughput, "tasks/s");
+
+    for (std::size_t w = 0; w < fan_in.size(); ++w)
+        out.add(impl, "omp task", threads, "fan_in/" + std::to_string(fan_widths[w]), median(fan_in[w]), "ns");
+
+    out.add(impl, "omp task", threads, "fib", tasks / fib_seconds, "tasks/s");
+
+    double sum = 0;
+    bench_clock::time_point start = bench_clock::now();
+
+#pragma omp parallel for num_threads(threads) reduction(+ : sum)
+    for (long i = 0; i < long(data.size()); ++i)
+        sum += data[i];
+
+    out.add(impl, "omp parallel for reduction", threads, "reduce", data.size() / seconds_since(start), "elements/s");
+}
+#endif
+
+#ifdef BENCH_TASK_GROUP
+long group_fib(int n)
+{
+    if (n < 2)
+        return n;
+
+    long x = 0;
+    long y = 0;
+    tbb::task_group group;
+
+    group.run([&x, n] { x = group_fib(n - 1); });
+    y = group_fib(n - 2);
+    group.wait();
+
+    return x + y;
+}
+
+void bench_task_group(results& out, unsigned int threads, const std::vector<double>& data)
+{
+    const char* impl = "tbb";
+    tbb::task_arena arena{int(threads)};
+
+    arena.execute([&] {
+        std::vector<double> samples;
+        tbb::task_group group;
+
+        for (unsigned int round = 0; round < latency_rounds; ++round)
+        {
+            std::atomic<std::int64_t> started(0);
+            std::int64_t start = now_ns();
+            group.run([&started] { started.store(now_ns(), std::memory_order_relaxed); });
+            group.wait();
+            samples.push_back(double(started.load() - start));
+        }
+
+        out.add(impl, "task_group", threads, "spawn_latency", median(samples), "ns");
+
+        std::atomic<unsigned int> done(0);
+        bench_clock::time_point start = bench_clock::now();
+
+        for (unsigned int i = 0; i < throughput_tasks; ++i)
+            group.run([&done] { done.fetch_add(1, std::memory_order_relaxed); });
+        group.wait();
+
+        out.add(impl, "task_group", threads, "throughput", throughput_tasks / seconds_since(start), "tasks/s");
+
+        for (unsigned int width : fan_widths)
+        {
+            std::vector<double> fan_in;
+
+            for (unsigned int round = 0; round < 50; ++round)
+            {
+                std::int64_t begin = now_ns();
+
+                for (unsigned int i = 0; i < width; ++i)
+                    group.run([&done] { done.fetch_add(1, std::memory_order_relaxed); });
+                group.wait();
+
+                fan_in.push_back(double(now_ns() - begin));
+            }
+
+            out.add(impl, "task_group", threads, "fan_in/" + std::to_string(width), median(fan_in), "ns");
+        }
+
+        start = bench_clock::now();
+        long tasks = group_fib(fib_depth + 1) - 1;
+        out.add(impl, "task_group", threads, "fib", tasks / seconds_since(start), "tasks/s");
+
+        start = bench_clock::now();
+        tbb::parallel_reduce(tbb::blocked_range<std::size_t>(0, data.size()), 0.0,
+                [&data](const tbb::blocked_range<std::size_t>& r, double sum) {
+                    return std::accumulate(data.begin() + r.begin(), data.begin() + r.end(), sum);
+                }, [](double a, double b) { return a + b; });
+        out.add(impl, "parallel_reduce", threads, "reduce", data.size() / seconds_since(start), "elements/s");
+    });
+}
+#endif
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    unsigned int hardware = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<unsigned int> thread_counts;
+
+    for (unsigned int threads = 1; threads < hardware; threads *= 2)
+        thread_counts.push_back(threads);
+    thread_counts.push_back(hardware);
+
+    std::vector<double> data(reduce_size, 1.0);
+    results out;
+
+    for (unsigned int threads : thread_counts)
+    {
+        // Unsynchronised overloads, spawn and parallel_reduce use the
+        // default executor.
+        cpp_utils::native_executor pool(threads);
+        cpp_utils::set_default_executor(pool);
+
+        bench_overloads(out, pool, threads);
+        bench_nested(out, threads, data);
+
+        cpp_utils::set_default_executor(cpp_utils::native_executor::instance());
+
+        bench_std(out, threads, data);
+
+#ifdef _OPENMP
+        bench_openmp(out, threads, data);
+#endif
+
+#ifdef BENCH_TASK_GROUP
+        bench_task_group(out, threads, data);
+#endif
+    }
+
+    std::FILE* file = argc > 1 ? std::fopen(argv[1], "w") : stdout;
+
+    if (!file)
+    {
+        std::perror(argv[1]);
+        return 1;
+    }
+
+    out.write(file);
+
+    if (file != stdout)
+        std::fclose(file);
+
+    return 0;
+}
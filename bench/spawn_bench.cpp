@@ -0,0 +1,85 @@
+/*    This file is part of cpp-utils
+ *    Copyright (c) 2010 Victor Vicente de Carvalho <victor.v.carvalho@gmail.com>
+ * 
+ *    cpp-utils is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    cpp-utils is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with corvogame.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * 
+ *    Spawn throughput of cpp_utils::parallel for several payload sizes.
+ *    Build it twice to compare the task pool against plain heap payloads:
+ *
+ *    g++ -O2 -std=c++14 -I../include spawn_bench.cpp -o spawn_bench -pthread
+ *    g++ -O2 -std=c++14 -I../include -DCPP_UTILS_DISABLE_TASK_POOL spawn_bench.cpp -o spawn_bench_heap -pthread
+ */
+
+#include "parallell.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+
+namespace
+{
+
+template <std::size_t Size>
+struct payload
+{
+    char bytes[Size];
+};
+
+template <std::size_t Size>
+double spawns_per_second(unsigned int spawns)
+{
+    payload<Size> data = payload<Size>();
+    std::atomic<unsigned int> sink(0);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    {
+        cpp_utils::synched_t synch;
+
+        for (unsigned int i = 0; i < spawns; ++i)
+            cpp_utils::parallel(synch, [data, &sink] { sink += data.bytes[0] + 1; });
+
+        synch.wait_for_all();
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return spawns / elapsed.count();
+}
+
+template <std::size_t Size>
+void report(unsigned int spawns)
+{
+    // First round warms up the scheduler and the free lists.
+    spawns_per_second<Size>(spawns);
+    std::printf("%6u bytes  %12.0f spawns/sec\n", unsigned(Size), spawns_per_second<Size>(spawns));
+}
+
+} // namespace
+
+int main()
+{
+    const unsigned int spawns = 1000000;
+
+#ifdef CPP_UTILS_DISABLE_TASK_POOL
+    std::printf("task pool disabled\n");
+#else
+    std::printf("task pool enabled\n");
+#endif
+
+    report<16>(spawns);
+    report<48>(spawns);
+    report<200>(spawns);
+    report<1000>(spawns);
+}
@@ -0,0 +1,374 @@
+/*    This file is part of cpp-utils
+ *    Copyright (c) 2010 Victor Vicente de Carvalho <victor.v.carvalho@gmail.com>
+ *
+ *    cpp-utils is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    cpp-utils is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with corvogame.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *    Coroutines on the task pool (needs C++20)
+ *    usage:
+ *
+ *   cpp_utils::task<int> handler ( request r )
+ *   {
+ *       cpp_utils::synched_t synch;
+ *       cpp_utils::parallel ( synch, lookup, r );
+ *       co_await synch.join ( );             //suspends, no thread blocked
+ *       int n = co_await other_handler ( r );  //another task<int>
+ *       co_return n;
+ *   }
+ *
+ *   //from plain code, blocking the calling thread:
+ *   int n = cpp_utils::sync_wait ( handler ( r ) );
+ *
+ *   A task starts running on default_executor () as soon as it is called,
+ *   like parallel; co_await or sync_wait collect its result.
+ */
+
+#pragma once
+
+#include "parallell.hpp"
+#include "phaser.hpp"
+
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <utility>
+
+namespace cpp_utils
+{
+
+// Awaitable that moves the coroutine onto an executor.
+class resume_on
+{
+public:
+    explicit resume_on(executor& exec = default_executor())
+            : mr_executor(exec)
+    {
+    }
+
+    bool await_ready() const
+    {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        mr_executor.spawn(*new detail::resume_task<std::coroutine_handle<> >(handle));
+    }
+
+    void await_resume()
+    {
+    }
+
+private:
+    executor& mr_executor;
+};
+
+template <typename T>
+class task;
+
+namespace detail
+{
+
+/*
+ * What a task's promise shares with its handle and its awaiter, in one
+ * word: running, done, detached (the handle went away first), or the
+ * address of the coroutine waiting for the result.
+ */
+class task_promise_base
+{
+public:
+    enum : std::uintptr_t
+    {
+        running = 0,
+        done = 1,
+        detached = 2
+    };
+
+    task_promise_base()
+            : m_state(running)
+    {
+    }
+
+    resume_on initial_suspend()
+    {
+        return resume_on();
+    }
+
+    struct final_awaiter
+    {
+        bool await_ready() noexcept
+        {
+            return false;
+        }
+
+        template <typename promise_t>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_t> handle) noexcept
+        {
+            std::uintptr_t waiter = handle.promise().m_state.exchange(done);
+
+            if (waiter == detached)
+                handle.destroy();
+            else if (waiter != running)
+                return std::coroutine_handle<>::from_address(reinterpret_cast<void*>(waiter));
+
+            return std::noop_coroutine();
+        }
+
+        void await_resume() noexcept
+        {
+        }
+    };
+
+    final_awaiter final_suspend() noexcept
+    {
+        return final_awaiter();
+    }
+
+    void unhandled_exception()
+    {
+        m_error = std::current_exception();
+    }
+
+    bool ready() const
+    {
+        return m_state.load(std::memory_order_acquire) == done;
+    }
+
+    // False when the task is already done and the waiter should go on.
+    bool set_waiter(std::coroutine_handle<> waiter)
+    {
+        std::uintptr_t expected = running;
+        return m_state.compare_exchange_strong(expected, reinterpret_cast<std::uintptr_t>(waiter.address()));
+    }
+
+    // True when the caller has to destroy the frame itself.
+    bool detach()
+    {
+        std::uintptr_t expected = running;
+        return !m_state.compare_exchange_strong(expected, detached);
+    }
+
+    void rethrow_error()
+    {
+        if (m_error)
+            std::rethrow_exception(m_error);
+    }
+
+private:
+    std::atomic<std::uintptr_t> m_state;
+    std::exception_ptr m_error;
+};
+
+template <typename T>
+class task_promise : public task_promise_base
+{
+public:
+    task<T> get_return_object();
+
+    template <typename U>
+    void return_value(U&& value)
+    {
+        m_result.emplace_from([&value]() -> T { return std::forward<U>(value); });
+    }
+
+    T take()
+    {
+        rethrow_error();
+        return m_result.take();
+    }
+
+private:
+    result_slot<T> m_result;
+};
+
+template <>
+class task_promise<void> : public task_promise_base
+{
+public:
+    task<void> get_return_object();
+
+    void return_void()
+    {
+    }
+
+    void take()
+    {
+        rethrow_error();
+    }
+};
+
+} // namespace detail
+
+/*
+ * Coroutine run on the executor. The handle owns the result: co_await it
+ * from another coroutine (which is resumed by whichever thread finishes
+ * the task) or hand it to sync_wait. Dropping it unawaited lets the
+ * coroutine run to completion on its own.
+ */
+template <typename T>
+class task
+{
+public:
+    typedef detail::task_promise<T> promise_type;
+    typedef std::coroutine_handle<promise_type> handle_type;
+
+    explicit task(handle_type handle)
+            : m_handle(handle)
+    {
+    }
+
+    task(task&& other)
+            : m_handle(std::exchange(other.m_handle, handle_type()))
+    {
+    }
+
+    task& operator=(task&& other)
+    {
+        std::swap(m_handle, other.m_handle);
+        return *this;
+    }
+
+    ~task()
+    {
+        if (m_handle && m_handle.promise().detach())
+            m_handle.destroy();
+    }
+
+    bool ready() const
+    {
+        return m_handle.promise().ready();
+    }
+
+    bool await_ready() const
+    {
+        return ready();
+    }
+
+    bool await_suspend(std::coroutine_handle<> waiter)
+    {
+        return m_handle.promise().set_waiter(waiter);
+    }
+
+    // Rethrows what the coroutine threw, if anything.
+    T await_resume()
+    {
+        return m_handle.promise().take();
+    }
+
+private:
+    task(const task&);
+    task& operator=(const task&);
+
+    handle_type m_handle;
+};
+
+namespace detail
+{
+
+template <typename T>
+task<T> task_promise<T>::get_return_object()
+{
+    return task<T>(std::coroutine_handle<task_promise<T> >::from_promise(*this));
+}
+
+inline task<void> task_promise<void>::get_return_object()
+{
+    return task<void>(std::coroutine_handle<task_promise<void> >::from_promise(*this));
+}
+
+// Bare coroutine that runs eagerly and frees itself, for sync_wait.
+struct detached_coroutine
+{
+    struct promise_type
+    {
+        detached_coroutine get_return_object()
+        {
+            return detached_coroutine();
+        }
+
+        std::suspend_never initial_suspend()
+        {
+            return std::suspend_never();
+        }
+
+        std::suspend_never final_suspend() noexcept
+        {
+            return std::suspend_never();
+        }
+
+        void return_void()
+        {
+        }
+
+        void unhandled_exception()
+        {
+            std::terminate();
+        }
+    };
+};
+
+// Waits for a task without taking its result.
+template <typename T>
+class ready_awaiter
+{
+public:
+    explicit ready_awaiter(task<T>& t)
+            : mr_task(t)
+    {
+    }
+
+    bool await_ready() const
+    {
+        return mr_task.await_ready();
+    }
+
+    bool await_suspend(std::coroutine_handle<> waiter)
+    {
+        return mr_task.await_suspend(waiter);
+    }
+
+    void await_resume()
+    {
+    }
+
+private:
+    task<T>& mr_task;
+};
+
+template <typename T>
+detached_coroutine signal_when_done(task<T>& t, latch& done)
+{
+    co_await ready_awaiter<T>(t);
+    done.count_down();
+}
+
+} // namespace detail
+
+/*
+ * Blocks the calling thread until t is done and returns its result. For
+ * plain code at the edge of a coroutine world; inside the pool, co_await
+ * instead.
+ */
+template <typename T>
+T sync_wait(task<T> t)
+{
+    latch done(1);
+    detail::signal_when_done(t, done);
+    done.wait();
+
+    return t.await_resume();
+}
+
+} // namespace cpp_utils
@@ -0,0 +1,583 @@
+/*    This file is part of cpp-utils
+ *    Copyright (c) 2010 Victor Vicente de Carvalho <victor.v.carvalho@gmail.com>
+ *
+ *    cpp-utils is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    cpp-utils is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with corvogame.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *    Executor: the scheduler interface behind parallel and synched_t
+ *
+ *    Tasks are task_base objects allocated from per-thread pools; an
+ *    executor runs them and lets joining threads help. The backends are
+ *    native_executor.hpp (work stealing, the default) and tbb_executor.hpp
+ *    (legacy tbb::task, with CPP_UTILS_USE_TBB).
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstddef>
+#include <ctime>
+#include <mutex>
+#include <new>
+
+#ifdef CPP_UTILS_TRACE
+#include "trace.hpp"
+#endif
+
+#include <linux/futex.h>
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace cpp_utils
+{
+
+namespace detail
+{
+
+// std::atomic<int> is a plain int underneath, so its address is a valid
+// futex word.
+inline int* futex_address(std::atomic<int>& word)
+{
+    return reinterpret_cast<int*>(&word);
+}
+
+inline void futex_wait(std::atomic<int>& word, int expected)
+{
+    syscall(SYS_futex, futex_address(word), FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+// Sleeps at most timeout (capped at a day; callers re-check anyway).
+template <typename rep_t, typename period_t>
+inline void futex_wait_for(std::atomic<int>& word, int expected, std::chrono::duration<rep_t, period_t> timeout)
+{
+    typedef std::chrono::duration<rep_t, period_t> duration_t;
+
+    duration_t day = std::chrono::duration_cast<duration_t>(std::chrono::hours(24));
+    std::chrono::nanoseconds ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::min(timeout, day));
+
+    timespec relative;
+    relative.tv_sec = time_t(ns.count() / 1000000000);
+    relative.tv_nsec = long(ns.count() % 1000000000);
+
+    syscall(SYS_futex, futex_address(word), FUTEX_WAIT_PRIVATE, expected, &relative, NULL, 0);
+}
+
+inline void futex_wake(std::atomic<int>& word, int count)
+{
+    syscall(SYS_futex, futex_address(word), FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+// Bitset forms: futex_wake_bits only wakes waiters whose bits intersect
+// its own, while plain futex_wake wakes any waiter.
+inline void futex_wait_bits(std::atomic<int>& word, int expected, unsigned int bits)
+{
+    syscall(SYS_futex, futex_address(word), FUTEX_WAIT_BITSET_PRIVATE, expected, NULL, NULL, bits);
+}
+
+inline void futex_wake_bits(std::atomic<int>& word, int count, unsigned int bits)
+{
+    syscall(SYS_futex, futex_address(word), FUTEX_WAKE_BITSET_PRIVATE, count, NULL, NULL, bits);
+}
+
+inline void cpu_relax()
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+// Exponential backoff for short spins; pause() returns false once the
+// caller should stop burning cycles and block instead.
+class backoff
+{
+public:
+    backoff()
+            : m_count(1)
+    {
+    }
+
+    bool pause()
+    {
+        if (m_count > max_spins)
+            return false;
+
+        for (int i = 0; i < m_count; ++i)
+            cpu_relax();
+
+        m_count <<= 1;
+        return true;
+    }
+
+    void reset()
+    {
+        m_count = 1;
+    }
+
+private:
+    enum { max_spins = 1 << 10 };
+
+    int m_count;
+};
+
+/*
+ * Per-thread free lists of fixed-size blocks, one list per size class,
+ * backing every task object; sizes beyond the largest class fall through
+ * to operator new. A block goes back to the list of whichever thread
+ * frees it. A list that grows past max_cached hands batch_size blocks to
+ * a shared depot, and an empty one takes a batch from there before going
+ * to the heap, so blocks allocated by one thread and freed by others (a
+ * thread outside the pool spawning, the workers running) come back too:
+ * steady-state spawning does no general-purpose heap traffic, and the
+ * depot lock is taken once per batch.
+ * Blocks are aligned for std::max_align_t and no more, which the task
+ * types allocated here check with a static_assert.
+ * Define CPP_UTILS_DISABLE_TASK_POOL to send every task to the heap (used
+ * by bench/spawn_bench.cpp as the baseline).
+ */
+class task_pool
+{
+public:
+    enum
+    {
+        min_block = 64,
+        class_count = 5,
+        max_block = min_block << (class_count - 1),
+        max_cached = 256,
+        batch_size = max_cached / 2
+    };
+
+    static void* allocate(std::size_t size)
+    {
+#ifndef CPP_UTILS_DISABLE_TASK_POOL
+        if (size <= max_block)
+        {
+            free_lists& lists = local();
+            int index = size_class(size);
+
+            if (!lists.heads[index] && !refill(lists, index))
+                return ::operator new(std::size_t(min_block) << index);
+
+            block* head = lists.heads[index];
+            lists.heads[index] = head->next;
+            --lists.counts[index];
+            return head;
+        }
+#endif
+        return ::operator new(size);
+    }
+
+    static void deallocate(void* p, std::size_t size)
+    {
+#ifndef CPP_UTILS_DISABLE_TASK_POOL
+        free_lists& lists = local();
+
+        if (size <= max_block && !lists.closed)
+        {
+            int index = size_class(size);
+
+            if (lists.counts[index] == max_cached)
+                spill(lists, index);
+
+            block* b = static_cast<block*>(p);
+            b->next = lists.heads[index];
+            lists.heads[index] = b;
+            ++lists.counts[index];
+            return;
+        }
+#else
+        (void) size;
+#endif
+        ::operator delete(p);
+    }
+
+private:
+    // next_batch links the first blocks of the batches in the depot.
+    struct block
+    {
+        block* next;
+        block* next_batch;
+    };
+
+    // Trivially destructible so that frees arriving during thread exit,
+    // after the drain below, still find valid (closed) lists.
+    struct free_lists
+    {
+        block* heads[class_count];
+        unsigned int counts[class_count];
+        bool closed;
+    };
+
+    struct drain_at_exit
+    {
+        ~drain_at_exit()
+        {
+            free_lists& lists = local();
+            lists.closed = true;
+
+            for (int i = 0; i < class_count; ++i)
+            {
+                while (block* b = lists.heads[i])
+                {
+                    lists.heads[i] = b->next;
+                    ::operator delete(b);
+                }
+                lists.counts[i] = 0;
+            }
+        }
+    };
+
+    static free_lists& local()
+    {
+        static thread_local free_lists lists;
+        static thread_local drain_at_exit drain;
+        (void) drain;
+        return lists;
+    }
+
+    // Never destroyed, like the blocks in it: threads may still free
+    // tasks during static destruction.
+    struct depot
+    {
+        std::mutex mutex;
+        block* batches[class_count];
+    };
+
+    static depot& shared_depot()
+    {
+        static depot* shared = new depot();
+        return *shared;
+    }
+
+    static bool refill(free_lists& lists, int index)
+    {
+        depot& shared = shared_depot();
+        std::lock_guard<std::mutex> lock(shared.mutex);
+        block* batch = shared.batches[index];
+
+        if (!batch)
+            return false;
+
+        shared.batches[index] = batch->next_batch;
+        lists.heads[index] = batch;
+        lists.counts[index] = batch_size;
+        return true;
+    }
+
+    // Moves the first batch_size blocks of a full list to the depot.
+    static void spill(free_lists& lists, int index)
+    {
+        block* batch = lists.heads[index];
+        block* last = batch;
+
+        for (int i = 1; i < batch_size; ++i)
+            last = last->next;
+
+        lists.heads[index] = last->next;
+        lists.counts[index] -= batch_size;
+        last->next = NULL;
+
+        depot& shared = shared_depot();
+        std::lock_guard<std::mutex> lock(shared.mutex);
+        batch->next_batch = shared.batches[index];
+        shared.batches[index] = batch;
+    }
+
+    static int size_class(std::size_t size)
+    {
+        int index = 0;
+        while ((std::size_t(min_block) << index) < size)
+            ++index;
+        return index;
+    }
+};
+
+} // namespace detail
+
+/*
+ * Unit of work handed to an executor. Executors call run() exactly once;
+ * by default the task deletes itself afterwards, back into task_pool.
+ * The callable lives inside the task object, so a spawn is one pooled
+ * allocation.
+ */
+class task_base
+{
+public:
+    task_base()
+            : mp_next(NULL)
+    {
+#ifdef CPP_UTILS_TRACE
+        trace::detail::on_spawn(m_trace_id, mp_trace_label);
+#endif
+    }
+
+    void run()
+    {
+#ifdef CPP_UTILS_TRACE
+        trace::detail::run_scope traced(m_trace_id, mp_trace_label);
+#endif
+        execute();
+        release();
+    }
+
+    static void* operator new(std::size_t size)
+    {
+        return detail::task_pool::allocate(size);
+    }
+
+    static void operator delete(void* p, std::size_t size)
+    {
+        detail::task_pool::deallocate(p, size);
+    }
+
+    // Placement form, for tasks embedded in a larger block.
+    static void* operator new(std::size_t /* size */, void* where)
+    {
+        return where;
+    }
+
+    static void operator delete(void* /* p */, void* /* where */)
+    {
+    }
+
+    // Intrusive link, owned by whichever queue holds the task.
+    task_base* mp_next;
+
+#ifdef CPP_UTILS_TRACE
+    std::uint64_t m_trace_id;
+    const char* mp_trace_label;
+#endif
+
+protected:
+    virtual ~task_base()
+    {
+    }
+
+    virtual void execute() = 0;
+
+    virtual void release()
+    {
+        delete this;
+    }
+};
+
+// Intrusive FIFO of tasks, for handing several to an executor at once.
+class task_list
+{
+public:
+    task_list()
+            : mp_head(NULL), mp_tail(NULL), m_size(0)
+    {
+    }
+
+    bool empty() const
+    {
+        return mp_head == NULL;
+    }
+
+    std::size_t size() const
+    {
+        return m_size;
+    }
+
+    void push_back(task_base& task)
+    {
+        task.mp_next = NULL;
+
+        if (mp_tail)
+            mp_tail->mp_next = &task;
+        else
+            mp_head = &task;
+
+        mp_tail = &task;
+        ++m_size;
+    }
+
+    task_base* pop_front()
+    {
+        task_base* task = mp_head;
+
+        if (task)
+        {
+            mp_head = task->mp_next;
+            if (!mp_head)
+                mp_tail = NULL;
+            task->mp_next = NULL;
+            --m_size;
+        }
+
+        return task;
+    }
+
+    // Moves all of other's tasks to the back of this list.
+    void splice_back(task_list& other)
+    {
+        if (other.empty())
+            return;
+
+        if (mp_tail)
+            mp_tail->mp_next = other.mp_head;
+        else
+            mp_head = other.mp_head;
+
+        mp_tail = other.mp_tail;
+        m_size += other.m_size;
+
+        other.mp_head = other.mp_tail = NULL;
+        other.m_size = 0;
+    }
+
+private:
+    task_base* mp_head;
+    task_base* mp_tail;
+    std::size_t m_size;
+};
+
+/*
+ * Per-join scratch for help-while-waiting. m_done is the native backends'
+ * signal; mp_handle is for backends that need their own object (the TBB
+ * one keeps its root task there).
+ */
+struct help_state
+{
+    help_state()
+            : m_done(0), mp_handle(NULL)
+    {
+    }
+
+    std::atomic<int> m_done;
+    void* mp_handle;
+};
+
+/*
+ * Lanes a task can be spawned into. Workers look at the higher lanes first.
+ * The native backend promotes a task that has waited about a millisecond
+ * in the low lane, and a worker that has spent about a millisecond on high
+ * tasks takes a normal one (from any deque or the injection list) next, so
+ * a flood of high priority tasks delays lower ones instead of starving
+ * them; TBB applies its own task priorities. Plain spawn() is normal.
+ */
+enum task_priority
+{
+    priority_high, priority_normal, priority_low, priority_count
+};
+
+/*
+ * Where a task would rather run: anywhere, on a given NUMA node, or on the
+ * node holding some memory it works on. A hint only: backends without NUMA
+ * groups ignore it, and the native one lets another node take the task
+ * rather than keep workers idle.
+ */
+class placement
+{
+public:
+    placement()
+            : m_node(-1)
+    {
+    }
+
+    static placement on_node(int node)
+    {
+        placement where;
+        where.m_node = node;
+        return where;
+    }
+
+    // Node of the page holding address, faulting it in if needed; anywhere
+    // when the kernel cannot tell.
+    static placement near(const void* address)
+    {
+        int node = -1;
+
+        if (syscall(SYS_get_mempolicy, &node, NULL, 0, address, MPOL_F_NODE | MPOL_F_ADDR) != 0)
+            node = -1;
+
+        return on_node(node);
+    }
+
+    bool anywhere() const
+    {
+        return m_node < 0;
+    }
+
+    int node() const
+    {
+        return m_node;
+    }
+
+private:
+    int m_node;
+};
+
+/*
+ * What parallel, synched_t and friends need from a scheduler.
+ *
+ * Helping is a small protocol driven by a join: prepare_help() arms the
+ * state before the join publishes that it is helping, help() then runs
+ * other tasks on the calling thread until finish_help() is called (from
+ * any thread, exactly once per prepare), and release_help() frees whatever
+ * the backend attached to the state.
+ */
+class executor
+{
+public:
+    virtual ~executor()
+    {
+    }
+
+    virtual void spawn(task_base& task) = 0;
+
+    virtual void spawn(task_list& tasks)
+    {
+        while (task_base* task = tasks.pop_front())
+            spawn(*task);
+    }
+
+    // Backends without lanes run every priority as normal.
+    virtual void spawn(task_base& task, task_priority /* priority */)
+    {
+        spawn(task);
+    }
+
+    // Backends without NUMA groups run the task anywhere.
+    virtual void spawn(task_base& task, placement /* where */)
+    {
+        spawn(task);
+    }
+
+    // Number of worker threads.
+    virtual unsigned int concurrency() const = 0;
+
+    virtual void prepare_help(help_state& state)
+    {
+        state.m_done.store(0, std::memory_order_relaxed);
+    }
+
+    virtual void help(help_state& state) = 0;
+
+    virtual void finish_help(help_state& state) = 0;
+
+    virtual void release_help(help_state& /* state */)
+    {
+    }
+};
+
+inline executor& default_executor();
+
+} // namespace cpp_utils
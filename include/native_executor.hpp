@@ -0,0 +1,1055 @@
+/*    This file is part of cpp-utils
+ *    Copyright (c) 2010 Victor Vicente de Carvalho <victor.v.carvalho@gmail.com>
+ *
+ *    cpp-utils is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    cpp-utils is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with corvogame.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *    Native work-stealing executor
+ *
+ *    One Chase-Lev deque per worker thread. Workers push and pop their own
+ *    deque at the bottom (LIFO, cache-warm) and steal from the top of a
+ *    random victim's when they run dry; spawns from outside the pool go
+ *    through a lock-free injection stack. High and low priority tasks get
+ *    shared lanes of their own around that. Idle workers spin briefly and
+ *    then sleep on a futex.
+ */
+
+#pragma once
+
+#include "executor.hpp"
+#include "ticks.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <deque>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+
+namespace cpp_utils
+{
+
+namespace detail
+{
+
+/*
+ * Chase-Lev deque, with the C11 memory orderings from Le, Pop, Cohen and
+ * Zappa Nardelli, "Correct and Efficient Work-Stealing for Weak Memory
+ * Models" (PPoPP 2013). push/pop are for the owning thread only, steal for
+ * everyone else. The ring grows on demand; outgrown rings are kept until
+ * the deque dies because a thief may still be reading one.
+ */
+class work_deque
+{
+public:
+    explicit work_deque(std::int64_t capacity = 1024)
+            : m_top(0), m_bottom(0), mp_ring(new ring(capacity))
+    {
+    }
+
+    ~work_deque()
+    {
+        delete mp_ring.load(std::memory_order_relaxed);
+
+        for (std::size_t i = 0; i < m_retired.size(); ++i)
+            delete m_retired[i];
+    }
+
+    void push(task_base* task)
+    {
+        std::int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+        std::int64_t top = m_top.load(std::memory_order_acquire);
+        ring* r = mp_ring.load(std::memory_order_relaxed);
+
+        if (bottom - top > r->m_capacity - 1)
+            r = grow(r, top, bottom);
+
+        r->put(bottom, task);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+
+    task_base* pop()
+    {
+        std::int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+        ring* r = mp_ring.load(std::memory_order_relaxed);
+        m_bottom.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::int64_t top = m_top.load(std::memory_order_relaxed);
+
+        if (top > bottom)
+        {
+            m_bottom.store(bottom + 1, std::memory_order_relaxed);
+            return NULL;
+        }
+
+        task_base* task = r->get(bottom);
+
+        if (top == bottom)
+        {
+            // Last element: race the thieves for it.
+            if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                    std::memory_order_relaxed))
+                task = NULL;
+            m_bottom.store(bottom + 1, std::memory_order_relaxed);
+        }
+
+        return task;
+    }
+
+    // May fail spuriously when another thread wins the same element.
+    task_base* steal()
+    {
+        std::int64_t top = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::int64_t bottom = m_bottom.load(std::memory_order_acquire);
+
+        if (top >= bottom)
+            return NULL;
+
+        ring* r = mp_ring.load(std::memory_order_acquire);
+        task_base* task = r->get(top);
+
+        if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                std::memory_order_relaxed))
+            return NULL;
+
+        return task;
+    }
+
+    // A hint only; the answer can be stale by the time it is used.
+    bool empty() const
+    {
+        return m_bottom.load(std::memory_order_relaxed) <= m_top.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct ring
+    {
+        explicit ring(std::int64_t capacity)
+                : m_capacity(capacity), m_mask(capacity - 1),
+                  mp_items(new std::atomic<task_base*>[capacity])
+        {
+        }
+
+        ~ring()
+        {
+            delete[] mp_items;
+        }
+
+        task_base* get(std::int64_t index) const
+        {
+            return mp_items[index & m_mask].load(std::memory_order_relaxed);
+        }
+
+        void put(std::int64_t index, task_base* task)
+        {
+            mp_items[index & m_mask].store(task, std::memory_order_relaxed);
+        }
+
+        const std::int64_t m_capacity;
+        const std::int64_t m_mask;
+        std::atomic<task_base*>* mp_items;
+    };
+
+    ring* grow(ring* old, std::int64_t top, std::int64_t bottom)
+    {
+        ring* bigger = new ring(old->m_capacity * 2);
+
+        for (std::int64_t i = top; i < bottom; ++i)
+            bigger->put(i, old->get(i));
+
+        m_retired.push_back(old);
+        mp_ring.store(bigger, std::memory_order_release);
+        return bigger;
+    }
+
+    // top is written by thieves, bottom only by the owner; keep them apart.
+    std::atomic<std::int64_t> m_top;
+    char m_top_pad[64];
+    std::atomic<std::int64_t> m_bottom;
+    std::atomic<ring*> mp_ring;
+    std::vector<ring*> m_retired;
+    char m_bottom_pad[64];
+};
+
+/*
+ * CPUs of each online NUMA node, read from sysfs. Without the node
+ * directory the machine comes out as a single node with no CPU list.
+ */
+struct numa_node
+{
+    int m_id;
+    std::vector<int> m_cpus;
+};
+
+// Parses a sysfs CPU list such as "0-3,8-11".
+inline std::vector<int> parse_cpu_list(const std::string& text)
+{
+    std::vector<int> cpus;
+    std::istringstream in(text);
+    std::string range;
+
+    while (std::getline(in, range, ','))
+    {
+        int first = 0;
+        int last = 0;
+        int fields = std::sscanf(range.c_str(), "%d-%d", &first, &last);
+
+        if (fields < 1)
+            continue;
+        if (fields == 1)
+            last = first;
+
+        for (int cpu = first; cpu <= last; ++cpu)
+            cpus.push_back(cpu);
+    }
+
+    return cpus;
+}
+
+inline std::vector<numa_node> numa_nodes()
+{
+    std::vector<numa_node> nodes;
+
+    if (DIR* dir = opendir("/sys/devices/system/node"))
+    {
+        while (dirent* entry = readdir(dir))
+        {
+            numa_node node;
+            char tail;
+
+            if (std::sscanf(entry->d_name, "node%d%c", &node.m_id, &tail) != 1)
+                continue;
+
+            std::ifstream list(std::string("/sys/devices/system/node/") + entry->d_name + "/cpulist");
+            std::string text;
+            std::getline(list, text);
+
+            node.m_cpus = parse_cpu_list(text);
+
+            if (!node.m_cpus.empty())
+                nodes.push_back(node);
+        }
+
+        closedir(dir);
+    }
+
+    std::sort(nodes.begin(), nodes.end(), [](const numa_node& a, const numa_node& b) { return a.m_id < b.m_id; });
+
+    if (nodes.empty())
+        nodes.push_back(numa_node { 0, std::vector<int>() });
+
+    return nodes;
+}
+
+} // namespace detail
+
+/*
+ * Workers belong to node groups. Without pinning there is one group with
+ * every worker and the scheduler behaves as a flat work-stealing pool. With
+ * pin_numa there is one group per NUMA node, its workers are pinned to the
+ * node's CPUs, and:
+ *
+ * - each group has a lane for tasks placed on its node, which its own
+ *   workers look at right after their deque;
+ * - thieves try the workers of their own node before remote ones, and
+ *   take from other nodes' lanes only when nothing else is left;
+ * - each group sleeps on its own futex, so a placed task wakes a worker
+ *   of its node, or one of another node when none of its own is asleep.
+ */
+class native_executor : public executor
+{
+public:
+    enum pinning
+    {
+        pin_none, pin_numa
+    };
+
+    // threads == 0 means one worker per hardware thread.
+    explicit native_executor(unsigned int threads = 0, pinning pin = pin_none)
+            : m_injected(NULL), m_stop(false)
+    {
+        // Lanes are aged in ticks. Measuring their rate needs a millisecond
+        // from here, which the first pool of a process waits out below.
+        detail::tick_clock::instance();
+
+        std::vector<detail::numa_node> nodes = pin == pin_numa ? detail::numa_nodes() : std::vector<detail::numa_node>();
+
+        for (std::size_t i = 0; i < nodes.size(); ++i)
+            m_groups.push_back(std::unique_ptr<node_group>(new node_group(nodes[i].m_id, nodes[i].m_cpus)));
+
+        if (m_groups.empty())
+            m_groups.push_back(std::unique_ptr<node_group>(new node_group(-1, std::vector<int>())));
+
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+
+        // Each worker goes to the node with the fewest workers per CPU, so
+        // the nodes take turns and each gets a share of the pool in
+        // proportion to its CPUs, however small the pool.
+        for (unsigned int i = 0; i < threads; ++i)
+        {
+            node_group& group = *m_groups[least_loaded_group()];
+
+            m_workers.push_back(std::unique_ptr<worker>(new worker(*this, group, i)));
+            group.m_workers.push_back(m_workers.back().get());
+            m_all_workers.push_back(m_workers.back().get());
+        }
+
+        // A node that got no worker cannot take placed tasks.
+        for (std::size_t i = 0; i < m_groups.size(); ++i)
+        {
+            if (m_groups[i]->m_workers.empty())
+                m_groups[i]->m_id = -1;
+        }
+
+        m_aging_ticks = std::uint64_t(double(aging_limit_ns) / detail::tick_clock::instance().ns_per_tick());
+        m_lanes[priority_low].m_timed = true;
+
+        // Only start once every deque exists; workers steal from all of them.
+        for (unsigned int i = 0; i < threads; ++i)
+            m_workers[i]->m_thread = std::thread(&native_executor::worker_loop, this,
+                    std::ref(*m_workers[i]));
+    }
+
+    // Tasks still queued at this point are leaked; join before destroying.
+    ~native_executor()
+    {
+        m_stop.store(true);
+
+        for (std::size_t i = 0; i < m_groups.size(); ++i)
+        {
+            m_groups[i]->m_epoch.fetch_add(1);
+            detail::futex_wake(m_groups[i]->m_epoch, INT_MAX);
+        }
+
+        for (std::size_t i = 0; i < m_workers.size(); ++i)
+            m_workers[i]->m_thread.join();
+    }
+
+    void spawn(task_base& task)
+    {
+        push(task);
+        wake(1);
+    }
+
+    void spawn(task_list& tasks)
+    {
+        std::size_t count = tasks.size();
+
+        if (worker* self = local_worker())
+        {
+            while (task_base* task = tasks.pop_front())
+                self->m_deque.push(task);
+        }
+        else
+        {
+            inject(tasks);
+        }
+
+        wake(int(std::min<std::size_t>(count, m_workers.size())));
+    }
+
+    // High and low priority tasks skip the local deque: they go to a lane
+    // every worker looks at, or a high one could wait behind the whole
+    // deque of the worker that spawned it.
+    void spawn(task_base& task, task_priority priority)
+    {
+        if (priority == priority_normal)
+            push(task);
+        else
+            push_lane(m_lanes[priority], task);
+
+        wake(1);
+    }
+
+    // A task placed on the spawning worker's own node stays in its deque;
+    // anything else goes to the lane of the node it was placed on.
+    void spawn(task_base& task, placement where)
+    {
+        node_group* group = group_of(where);
+
+        if (!group)
+        {
+            spawn(task);
+            return;
+        }
+
+        worker* self = local_worker();
+
+        if (self && self->mp_group == group)
+        {
+            self->m_deque.push(&task);
+            wake(1);
+            return;
+        }
+
+        push_lane(group->m_lane, task);
+
+        // With the whole node busy, an idle worker elsewhere takes it.
+        if (!wake_group(*group, 1))
+            wake(1);
+    }
+
+    unsigned int concurrency() const
+    {
+        return static_cast<unsigned int>(m_workers.size());
+    }
+
+    void help(help_state& state)
+    {
+        worker* self = local_worker();
+        detail::backoff backoff;
+
+        while (state.m_done.load(std::memory_order_acquire) == 0)
+        {
+            if (task_base* task = find_task(self))
+            {
+                task->run();
+                backoff.reset();
+            }
+            else if (!backoff.pause())
+            {
+                sleep(self, [&state] { return state.m_done.load(std::memory_order_relaxed) != 0; }, helper_bits(state));
+                backoff.reset();
+            }
+        }
+    }
+
+    // Wakes the helper of this state (and whoever shares its bit), not
+    // every sleeping worker. The state may be gone as soon as m_done is
+    // set, so its bit is taken first.
+    void finish_help(help_state& state)
+    {
+        unsigned int bits = helper_bits(state);
+
+        state.m_done.store(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        for (std::size_t i = 0; i < m_groups.size(); ++i)
+        {
+            node_group& group = *m_groups[i];
+
+            if (group.m_sleepers.load(std::memory_order_relaxed) > 0)
+            {
+                group.m_epoch.fetch_add(1, std::memory_order_release);
+                detail::futex_wake_bits(group.m_epoch, INT_MAX, bits);
+            }
+        }
+    }
+
+    // Runs one queued task on the calling thread, if any can be found.
+    bool run_one()
+    {
+        task_base* task = find_task(local_worker());
+
+        if (task)
+            task->run();
+        return task != NULL;
+    }
+
+    static native_executor& instance()
+    {
+        static native_executor executor;
+        return executor;
+    }
+
+private:
+    struct node_group;
+
+    struct worker
+    {
+        worker(native_executor& owner, node_group& group, unsigned int index)
+                : mr_owner(owner), mp_group(&group), m_index(index), m_seed(index * 2654435761u + 1),
+                  m_high_since(0)
+        {
+        }
+
+        detail::work_deque m_deque;
+        native_executor& mr_owner;
+        node_group* mp_group;
+        std::thread m_thread;
+        unsigned int m_index;
+        std::uint32_t m_seed;
+
+        // When this worker started its current run of high lane tasks, in
+        // ticks; 0 after anything else.
+        std::uint64_t m_high_since;
+    };
+
+    // Shared FIFO for one priority or node. The count lets find_task skip
+    // an empty lane without taking the lock. A timed lane (the low one)
+    // also keeps the enqueue time of every push in m_arrivals, oldest
+    // first, with the number of tasks it brought, and m_oldest tells how
+    // long its first task has been waiting (in ticks, 0 when empty).
+    struct lane
+    {
+        lane()
+                : m_timed(false), m_count(0), m_oldest(0)
+        {
+        }
+
+        bool m_timed;
+        std::mutex m_mutex;
+        task_list m_tasks;
+        std::deque<std::pair<std::uint64_t, std::size_t> > m_arrivals;
+        std::atomic<std::size_t> m_count;
+        std::atomic<std::uint64_t> m_oldest;
+        char m_pad[64];
+    };
+
+    // The workers of one NUMA node (or of the whole pool, unpinned); m_id
+    // is -1 when placement hints cannot target the group. m_sleepers
+    // counts the threads inside sleep(): the low bits those nobody has
+    // woken yet, the bits from claim_unit up those a waker has already
+    // claimed, so that further spawns do not wake them again.
+    struct node_group
+    {
+        node_group(int id, const std::vector<int>& cpus)
+                : m_id(id), m_cpus(cpus), m_epoch(0), m_sleepers(0)
+        {
+        }
+
+        int m_id;
+        std::vector<int> m_cpus;
+        std::vector<worker*> m_workers;
+        lane m_lane;
+        std::atomic<int> m_epoch;
+        std::atomic<int> m_sleepers;
+        char m_pad[64];
+    };
+
+    enum
+    {
+        claim_unit = 1 << 16,
+        unclaimed_mask = claim_unit - 1
+    };
+
+    // How long a task may wait in the low lane before it is taken ahead of
+    // the lanes above it, and how long a worker runs high tasks back to
+    // back before it looks for normal work first.
+    enum { aging_limit_ns = 1000 * 1000 };
+
+    static worker*& current_worker()
+    {
+        static thread_local worker* current = NULL;
+        return current;
+    }
+
+    // The calling thread's worker, if it belongs to this executor.
+    worker* local_worker() const
+    {
+        worker* self = current_worker();
+        return (self && &self->mr_owner == this) ? self : NULL;
+    }
+
+    static std::uint32_t next_random(std::uint32_t& seed)
+    {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return seed;
+    }
+
+    void push(task_base& task)
+    {
+        if (worker* self = local_worker())
+        {
+            self->m_deque.push(&task);
+            return;
+        }
+
+        inject(task, task);
+    }
+
+    /*
+     * Spawns from outside the pool go on a stack, newest first, with one
+     * compare-and-swap. A worker takes the whole stack with one exchange,
+     * keeps the oldest task to run and pushes the rest on its deque (newest
+     * first, so that it pops them oldest first and thieves can share them).
+     * Order across the stack is thus only roughly FIFO.
+     */
+    void inject(task_base& newest, task_base& oldest)
+    {
+        task_base* head = m_injected.load(std::memory_order_relaxed);
+
+        do
+            oldest.mp_next = head;
+        while (!m_injected.compare_exchange_weak(head, &newest, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    void inject(task_list& tasks)
+    {
+        task_base* oldest = tasks.pop_front();
+        task_base* newest = oldest;
+
+        if (!oldest)
+            return;
+
+        while (task_base* task = tasks.pop_front())
+        {
+            task->mp_next = newest;
+            newest = task;
+        }
+
+        inject(*newest, *oldest);
+    }
+
+    // Threads from outside the pool have no deque: they run the oldest
+    // task and put the others back.
+    task_base* take_injected(worker* self)
+    {
+        if (!m_injected.load(std::memory_order_relaxed))
+            return NULL;
+
+        task_base* task = m_injected.exchange(NULL, std::memory_order_acquire);
+
+        if (!task)
+            return NULL;
+
+        // Once pushed, a task can be stolen and freed: read its link first.
+        if (self)
+        {
+            while (task_base* next = task->mp_next)
+            {
+                self->m_deque.push(task);
+                task = next;
+            }
+
+            return task;
+        }
+
+        task_base* newest = task;
+        task_base* before = NULL;
+
+        for (; task->mp_next; task = task->mp_next)
+            before = task;
+
+        if (before)
+            inject(*newest, *before);
+
+        return task;
+    }
+
+    void push_lane(lane& target, task_base& task)
+    {
+        std::uint64_t now = target.m_timed ? detail::ticks() : 0;
+        std::lock_guard<std::mutex> lock(target.m_mutex);
+
+        target.m_tasks.push_back(task);
+        arrived(target, now, 1);
+    }
+
+    void splice_lane(lane& target, task_list& tasks)
+    {
+        std::uint64_t now = target.m_timed ? detail::ticks() : 0;
+        std::size_t count = tasks.size();
+        std::lock_guard<std::mutex> lock(target.m_mutex);
+
+        target.m_tasks.splice_back(tasks);
+        arrived(target, now, count);
+    }
+
+    static task_base* take_lane(lane& source)
+    {
+        if (source.m_count.load(std::memory_order_relaxed) == 0)
+            return NULL;
+
+        std::lock_guard<std::mutex> lock(source.m_mutex);
+        task_base* task = source.m_tasks.pop_front();
+
+        if (task && source.m_timed && --source.m_arrivals.front().second == 0)
+        {
+            source.m_arrivals.pop_front();
+            source.m_oldest.store(source.m_arrivals.empty() ? 0 : source.m_arrivals.front().first,
+                    std::memory_order_relaxed);
+        }
+
+        source.m_count.store(source.m_tasks.size(), std::memory_order_relaxed);
+        return task;
+    }
+
+    // With the lane locked. Pushes closer together than a sixteenth of the
+    // aging limit share an entry, stamped with the first of them.
+    void arrived(lane& target, std::uint64_t now, std::size_t count)
+    {
+        target.m_count.store(target.m_tasks.size(), std::memory_order_relaxed);
+
+        if (count == 0 || !target.m_timed)
+            return;
+
+        if (target.m_arrivals.empty())
+            target.m_oldest.store(now, std::memory_order_relaxed);
+
+        if (!target.m_arrivals.empty() && now - target.m_arrivals.back().first < m_aging_ticks / 16)
+            target.m_arrivals.back().second += count;
+        else
+            target.m_arrivals.push_back(std::make_pair(now, count));
+    }
+
+    /*
+     * High lane, then normal work (own deque, injected, stolen), then the
+     * low lane. Two things keep the lower ones moving under a flood of
+     * high priority work:
+     *
+     * - a worker that has run high tasks back to back for aging_limit_ns
+     *   looks for normal work first, wherever it is queued (its own deque,
+     *   the injection list, other workers' deques), so each worker runs a
+     *   normal task at least that often;
+     * - a task that has waited aging_limit_ns in the low lane goes ahead
+     *   of everything, so it waits about that long plus the time to drain
+     *   the low tasks queued before it.
+     *
+     * Threads from outside the pool keep no streak; they only help.
+     */
+    task_base* find_task(worker* self)
+    {
+        if (task_base* task = take_overdue())
+            return task;
+
+        if (m_lanes[priority_high].m_count.load(std::memory_order_relaxed) != 0)
+        {
+            std::uint64_t now = self ? detail::ticks() : 0;
+
+            if (self && self->m_high_since != 0 && now - self->m_high_since > m_aging_ticks)
+            {
+                if (task_base* task = find_normal(self))
+                {
+                    self->m_high_since = 0;
+                    return task;
+                }
+            }
+
+            if (task_base* task = take_lane(m_lanes[priority_high]))
+            {
+                if (self && self->m_high_since == 0)
+                    self->m_high_since = now;
+                return task;
+            }
+        }
+
+        if (self)
+            self->m_high_since = 0;
+
+        if (task_base* task = find_normal(self))
+            return task;
+        return take_lane(m_lanes[priority_low]);
+    }
+
+    // The clock is only read while the low lane has something in it.
+    task_base* take_overdue()
+    {
+        lane& low = m_lanes[priority_low];
+        std::uint64_t since = low.m_oldest.load(std::memory_order_relaxed);
+
+        if (since == 0 || detail::ticks() - since <= m_aging_ticks)
+            return NULL;
+
+        return take_lane(low);
+    }
+
+    /*
+     * Own deque, own node's lane, injected tasks, then stealing: from the
+     * workers of the own node first, then from the others, and as a last
+     * resort from the lanes of the other nodes.
+     */
+    task_base* find_normal(worker* self)
+    {
+        node_group* home = self ? self->mp_group : NULL;
+
+        if (self)
+        {
+            if (task_base* task = self->m_deque.pop())
+                return task;
+            if (task_base* task = take_lane(home->m_lane))
+                return task;
+        }
+
+        if (task_base* task = take_injected(self))
+            return task;
+
+        static thread_local std::uint32_t outsider_seed = 0x9e3779b9u;
+        std::uint32_t& seed = self ? self->m_seed : outsider_seed;
+
+        if (home)
+        {
+            if (task_base* task = steal(home->m_workers, self, NULL, seed))
+                return task;
+            if (m_groups.size() == 1)
+                return NULL;
+        }
+
+        if (task_base* task = steal(m_all_workers, self, home, seed))
+            return task;
+
+        for (std::size_t i = 0; i < m_groups.size(); ++i)
+        {
+            if (m_groups[i].get() == home)
+                continue;
+            if (task_base* task = take_lane(m_groups[i]->m_lane))
+                return task;
+        }
+
+        return NULL;
+    }
+
+    // Tries every victim once from a random start, skipping self and the
+    // workers of skip.
+    static task_base* steal(const std::vector<worker*>& victims, worker* self, node_group* skip, std::uint32_t& seed)
+    {
+        std::size_t count = victims.size();
+        std::size_t start = next_random(seed) % count;
+
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            worker* victim = victims[(start + i) % count];
+
+            if (victim == self || victim->mp_group == skip)
+                continue;
+            if (task_base* task = victim->m_deque.steal())
+                return task;
+        }
+
+        return NULL;
+    }
+
+    node_group* group_of(placement where)
+    {
+        if (where.anywhere())
+            return NULL;
+
+        for (std::size_t i = 0; i < m_groups.size(); ++i)
+        {
+            if (m_groups[i]->m_id == where.node())
+                return m_groups[i].get();
+        }
+
+        return NULL;
+    }
+
+    bool has_work() const
+    {
+        if (m_injected.load(std::memory_order_relaxed))
+            return true;
+
+        for (int i = 0; i < priority_count; ++i)
+        {
+            if (m_lanes[i].m_count.load(std::memory_order_relaxed) != 0)
+                return true;
+        }
+
+        for (std::size_t i = 0; i < m_groups.size(); ++i)
+        {
+            if (m_groups[i]->m_lane.m_count.load(std::memory_order_relaxed) != 0)
+                return true;
+        }
+
+        for (std::size_t i = 0; i < m_workers.size(); ++i)
+        {
+            if (!m_workers[i]->m_deque.empty())
+                return true;
+        }
+
+        return false;
+    }
+
+    /*
+     * Sleeps until woken, unless work or the predicate shows up first.
+     * Pairs with wake(): a sleeper announces itself and then rechecks, a
+     * producer publishes and then looks for sleepers, with a full fence on
+     * both sides, so at least one of them sees the other. Threads from
+     * outside the pool sleep with the first group.
+     *
+     * Idle workers sleep on worker_bit and helpers on a bit of their own
+     * help_state: new work wakes either kind, a finished join only its
+     * helper.
+     */
+    enum { worker_bit = 1 };
+
+    static unsigned int helper_bits(const help_state& state)
+    {
+        return 2u << (reinterpret_cast<std::uintptr_t>(&state) / alignof(help_state) % 31);
+    }
+
+    template <typename predicate_t>
+    void sleep(worker* self, predicate_t done, unsigned int bits = worker_bit)
+    {
+        node_group& group = self ? *self->mp_group : *m_groups[0];
+        int epoch = group.m_epoch.load(std::memory_order_acquire);
+
+        group.m_sleepers.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (!m_stop.load(std::memory_order_relaxed) && !done() && !has_work())
+            detail::futex_wait_bits(group.m_epoch, epoch, bits);
+
+        // Sleepers are interchangeable: whoever leaves first takes a claim
+        // if there is one, which keeps the unclaimed count exact.
+        int sleepers = group.m_sleepers.load(std::memory_order_relaxed);
+
+        while (!group.m_sleepers.compare_exchange_weak(sleepers,
+                sleepers - (sleepers >= claim_unit ? claim_unit : 1), std::memory_order_relaxed))
+        {
+        }
+    }
+
+    // Claims up to count of the group's unwoken sleepers; returns how many.
+    static int claim(node_group& group, int count)
+    {
+        int sleepers = group.m_sleepers.load(std::memory_order_relaxed);
+        int taken;
+
+        do
+        {
+            taken = std::min(count, sleepers & unclaimed_mask);
+
+            if (taken == 0)
+                return 0;
+        }
+        while (!group.m_sleepers.compare_exchange_weak(sleepers, sleepers - taken + taken * claim_unit,
+                std::memory_order_relaxed));
+
+        return taken;
+    }
+
+    // Wakes up to count sleepers, from the caller's own group outwards.
+    // Sleepers already woken but not yet running are not woken again, so
+    // a burst of spawns costs one futex call per sleeper, not per spawn.
+    void wake(int count)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        worker* self = local_worker();
+        std::size_t groups = m_groups.size();
+        std::size_t first = 0;
+
+        if (self)
+        {
+            while (m_groups[first].get() != self->mp_group)
+                ++first;
+        }
+
+        for (std::size_t i = 0; i < groups && count > 0; ++i)
+        {
+            node_group& group = *m_groups[(first + i) % groups];
+            int claimed = claim(group, count);
+
+            if (claimed > 0)
+            {
+                group.m_epoch.fetch_add(1, std::memory_order_release);
+                detail::futex_wake(group.m_epoch, claimed);
+                count -= claimed;
+            }
+        }
+    }
+
+    // False when the group had nobody asleep and unwoken.
+    bool wake_group(node_group& group, int count)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        int claimed = claim(group, count);
+
+        if (claimed == 0)
+            return false;
+
+        group.m_epoch.fetch_add(1, std::memory_order_release);
+        detail::futex_wake(group.m_epoch, claimed);
+        return true;
+    }
+
+    std::size_t least_loaded_group() const
+    {
+        std::size_t best = 0;
+
+        for (std::size_t i = 1; i < m_groups.size(); ++i)
+        {
+            std::size_t cpus = std::max<std::size_t>(1, m_groups[i]->m_cpus.size());
+            std::size_t best_cpus = std::max<std::size_t>(1, m_groups[best]->m_cpus.size());
+
+            if (m_groups[i]->m_workers.size() * best_cpus < m_groups[best]->m_workers.size() * cpus)
+                best = i;
+        }
+
+        return best;
+    }
+
+    void worker_loop(worker& self)
+    {
+        current_worker() = &self;
+        pin(self.mp_group->m_cpus);
+        detail::backoff backoff;
+
+        while (!m_stop.load(std::memory_order_acquire))
+        {
+            if (task_base* task = find_task(&self))
+            {
+                task->run();
+                backoff.reset();
+            }
+            else if (!backoff.pause())
+            {
+                sleep(&self, [] { return false; });
+                backoff.reset();
+            }
+        }
+    }
+
+    static void pin(const std::vector<int>& cpus)
+    {
+        if (cpus.empty())
+            return;
+
+        cpu_set_t set;
+        CPU_ZERO(&set);
+
+        for (std::size_t i = 0; i < cpus.size(); ++i)
+            CPU_SET(cpus[i], &set);
+
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    native_executor(const native_executor&);
+    native_executor& operator=(const native_executor&);
+
+    std::vector<std::unique_ptr<worker>> m_workers;
+    std::vector<worker*> m_all_workers;
+    std::vector<std::unique_ptr<node_group> > m_groups;
+
+    // Normal spawns from outside go to m_injected; the normal lane is
+    // left empty.
+    lane m_lanes[priority_count];
+    std::uint64_t m_aging_ticks;
+
+    std::atomic<task_base*> m_injected;
+    char m_injected_pad[64];
+
+    std::atomic<bool> m_stop;
+};
+
+} // namespace cpp_utils
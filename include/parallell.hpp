@@ -24,6 +24,54 @@
  *   //FOR SYNCHRONIZED PARALLEL execution:
  *   cpp_utils::synched_t synch;
  *   cpp_utils::parallel ( synch, function_to_be_called )
+ *
+ *   //FOR FAN-OUTS, one task per index with a single allocation and spawn:
+ *   cpp_utils::parallel_batch ( synch, count, body )
+ *
+ *   //FOR LOOPS, split into adaptively sized chunks of body ( index ):
+ *   cpp_utils::parallel_for ( synch, 0, count, body )
+ *
+ *   //FOR REDUCTIONS, blocking until the combined value is ready:
+ *   sum = cpp_utils::parallel_reduce ( 0, count, 0, map, combine )
+ *
+ *   //FOR RESULTS, a handle whose get() waits for the value:
+ *   cpp_utils::async_value<int> v = cpp_utils::spawn ( function_to_be_called, args... );
+ *   int result = v.get ();
+ *
+ *   //continuations run once their inputs are ready, without blocking:
+ *   v.then ( next_stage );   cpp_utils::when_all ( std::move ( a ), std::move ( b ) );
+ *
+ *   //bounded joins: returns join_timeout instead of waiting past the deadline
+ *   synch.wait_for ( std::chrono::milliseconds ( 50 ), cpp_utils::synched_t::timeout_cancel );
+ *
+ *   //synch.cancel () skips the group's tasks that have not started yet;
+ *   //running ones poll cpp_utils::this_task::is_cancelled ()
+ *
+ *   //exceptions from tasks without a group go to a process-wide handler
+ *   //( std::terminate unless one is set ):
+ *   cpp_utils::set_unhandled_exception_handler ( log_and_continue );
+ *
+ *   //bounded fire-and-forget: block, run inline or throw past max_in_flight
+ *   cpp_utils::admission_limit limit ( 10000, cpp_utils::admission_limit::admit_block );
+ *   cpp_utils::parallel ( limit, function_to_be_called, args... );
+ *
+ *   //latency-sensitive work ahead of bulk jobs (priority_high, _normal, _low):
+ *   cpp_utils::parallel ( cpp_utils::priority_high, synch, handle_request, req );
+ *
+ *   //NUMA placement hint, for a native_executor built with pin_numa:
+ *   cpp_utils::parallel_for ( cpp_utils::placement::near ( data ), synch, 0, count, body )
+ *
+ *   //many threads spawning into one group: cpp_utils::synched_tree_t synch;
+ *   //or a child scope counting locally: cpp_utils::synched_t inner ( synch );
+ *
+ *   //waiting inside a task runs other tasks until the group is done
+ *   //(x10 finish); outside of tasks the caller sleeps instead:
+ *   cpp_utils::synched_t synch ( cpp_utils::synched_t::join_help );
+ *
+ *   //tasks go to cpp_utils::default_executor (), native work stealing unless
+ *   //CPP_UTILS_USE_TBB is defined; a group can be given its own:
+ *   cpp_utils::native_executor pool ( 4 );
+ *   cpp_utils::synched_t synch ( cpp_utils::synched_t::join_auto, cpp_utils::synched_t::error_continue, pool );
  */
 
 #pragma once
@@ -33,199 +81,2329 @@
 
 #include <iostream>
 
-#include <semaphore.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
-#include <tbb/atomic.h>
-#include <tbb/task.h>
+#include "executor.hpp"
+#include "stats.hpp"
 
+#ifdef CPP_UTILS_USE_TBB
+#include "tbb_executor.hpp"
+#else
+#include "native_executor.hpp"
+#endif
 
 namespace cpp_utils
 {
 
-struct scope_waiter
+namespace detail
 {
-    scope_waiter(sem_t& futex)
-            : mr_sem(futex)
-    {
-    }
 
-    scope_waiter(const scope_waiter& other)
-            : mr_sem(other.mr_sem)
+inline int& task_depth()
+{
+    static thread_local int depth = 0;
+    return depth;
+}
+
+// True while the calling thread is running one of our tasks.
+inline bool in_task()
+{
+    return task_depth() != 0;
+}
+
+// Small process-unique number for the calling thread, starting at 1.
+inline unsigned int thread_id()
+{
+    static std::atomic<unsigned int> next(0);
+    static thread_local unsigned int id = ++next;
+    return id;
+}
+
+// Cancellation flag of the group whose task the thread is running.
+inline const std::atomic<bool>*& current_cancel_flag()
+{
+    static thread_local const std::atomic<bool>* flag = NULL;
+    return flag;
+}
+
+struct task_scope
+{
+    explicit task_scope(const std::atomic<bool>* cancel_flag = NULL)
+            : mp_saved_flag(current_cancel_flag())
     {
+        ++task_depth();
+        current_cancel_flag() = cancel_flag;
     }
 
-    ~scope_waiter()
+    ~task_scope()
     {
-        sem_post(&mr_sem);
+        current_cancel_flag() = mp_saved_flag;
+        --task_depth();
     }
 
-protected:
-    sem_t& mr_sem;
+    const std::atomic<bool>* mp_saved_flag;
 };
 
-struct synched_t
+inline std::atomic<executor*>& default_executor_slot()
+{
+    static std::atomic<executor*> slot(NULL);
+    return slot;
+}
+
+} // namespace detail
+
+// Executor behind synched_t, parallel and spawn unless told otherwise.
+inline executor& default_executor()
+{
+    if (executor* current = detail::default_executor_slot().load(std::memory_order_acquire))
+        return *current;
+
+#ifdef CPP_UTILS_USE_TBB
+    return tbb_executor::instance();
+#else
+    return native_executor::instance();
+#endif
+}
+
+// Groups constructed before the switch keep the executor they were given.
+inline void set_default_executor(executor& exec)
+{
+    detail::default_executor_slot().store(&exec, std::memory_order_release);
+}
+
+/*
+ * Read side of a synched_t's cancellation flag. Checking it is a relaxed
+ * load, cheap enough for the inner loop of a long-running body; a default
+ * constructed token is never cancelled.
+ *
+ * The token points into the group and owns nothing: it must not be used
+ * once the synched_t is destroyed. Each join also clears the flag, so a
+ * token only reports the round it was taken in.
+ */
+class cancellation_token
 {
-    synched_t()
+public:
+    cancellation_token()
+            : mp_flag(NULL)
     {
-        m_count = 0;
-        sem_init(&m_sem, 0 , 0);
     }
 
-    scope_waiter register_lock()
+    explicit cancellation_token(const std::atomic<bool>& flag)
+            : mp_flag(&flag)
     {
-        m_count++;
-        return scope_waiter(m_sem);
     }
-    
-    void wait_for_all()
+
+    bool is_cancelled() const
     {
-        for (unsigned int  i = 0; i < m_count; ++i)
-        {
-            sem_wait(&m_sem);
-        }
-        m_count = 0;
+        return mp_flag && mp_flag->load(std::memory_order_relaxed);
     }
 
-    ~synched_t()
+private:
+    const std::atomic<bool>* mp_flag;
+};
+
+namespace this_task
+{
+
+// Token of the group the calling task belongs to; valid while that group
+// is, which is at least until the calling task returns.
+inline cancellation_token cancellation()
+{
+    const std::atomic<bool>* flag = detail::current_cancel_flag();
+    return flag ? cancellation_token(*flag) : cancellation_token();
+}
+
+inline bool is_cancelled()
+{
+    const std::atomic<bool>* flag = detail::current_cancel_flag();
+    return flag && flag->load(std::memory_order_relaxed);
+}
+
+} // namespace this_task
+
+namespace detail
+{
+
+// Resumes a suspended coroutine as a task on an executor.
+template <typename handle_t>
+class resume_task : public task_base
+{
+public:
+    explicit resume_task(handle_t handle)
+            : m_handle(handle)
     {
-      wait_for_all();
     }
 
 protected:
-    sem_t m_sem;
-    tbb::atomic<unsigned int> m_count;
+    void execute()
+    {
+        task_scope scope;
+        m_handle.resume();
+    }
+
+private:
+    handle_t m_handle;
 };
 
-template < typename function_t>
-class contended_caller : public tbb::task
+} // namespace detail
+
+struct synched_t;
+
+struct scope_waiter
 {
-public:
-    contended_caller(synched_t& sb, function_t& func)
-            : m_sw(sb.register_lock()) , m_func(func)
+    explicit scope_waiter(synched_t& sb);
+
+    scope_waiter(scope_waiter&& other)
+            : mp_sb(other.mp_sb), m_queued(other.m_queued)
     {
+        other.mp_sb = NULL;
     }
 
-    tbb::task* execute()
-    {
-        m_func();
+    ~scope_waiter();
+
+    // Hands an exception thrown by the task to the group's join.
+    void capture_exception(std::exception_ptr error);
+
+    // True once the group has given up on tasks that have not started.
+    bool cancelled() const;
+
+    const std::atomic<bool>* cancel_flag() const;
 
-        return NULL;
+    // The group's statistics, or NULL; and when the task was registered,
+    // in ticks, if it has them.
+    task_stats* stats() const;
+
+    std::uint64_t queued_at() const
+    {
+        return m_queued;
     }
 
-    scope_waiter m_sw;
-    function_t m_func;
+protected:
+    scope_waiter(const scope_waiter&);
+    scope_waiter& operator=(const scope_waiter&);
+
+    synched_t* mp_sb;
+    std::uint64_t m_queued;
 };
 
-template <typename function_t>
-class simple_caller : public tbb::task
+namespace detail
+{
+
+// Brackets the body of a group's task, for the group's task_stats.
+class stats_scope
 {
 public:
-    simple_caller( function_t& func)
-            :  m_func(func)
+    explicit stats_scope(const scope_waiter& sw)
+            : mp_stats(sw.stats()), m_queued(sw.queued_at()), m_start(mp_stats ? detail::ticks() : 0)
     {
     }
 
-    tbb::task* execute()
+    ~stats_scope()
     {
-        m_func();
-        return NULL;
+        if (mp_stats)
+            mp_stats->record(m_start - std::min(m_start, m_queued), detail::ticks() - m_start);
     }
 
-    function_t m_func;
+private:
+    task_stats* mp_stats;
+    std::uint64_t m_queued;
+    std::uint64_t m_start;
 };
 
+} // namespace detail
 
-template < uint N >
-struct apply_obj_func
+/*
+ * Join point for a group of tasks. All state lives in one futex word: the
+ * low bits count the tasks still pending and the top bit tells whether the
+ * joining thread is parked on it. wait_for_all spins with backoff first and
+ * only sleeps when the tasks take longer than that, so a join costs at most
+ * one futex wait and one wake however many tasks were registered.
+ *
+ * A worker that sleeps in a join takes a core out of the pool, and nested
+ * fork/join can then starve or deadlock it. In join_help mode the waiter
+ * instead helps its executor run queued tasks until the last scope_waiter
+ * calls finish_help. join_auto helps when called from inside one of our
+ * tasks and parks otherwise. Tasks are spawned on the executor given at
+ * construction, default_executor() unless stated.
+ *
+ * The first exception thrown by a task of the group is kept and rethrown
+ * by wait_for_all once every task has finished; later ones are dropped.
+ * With error_cancel, the failure also cancels the group.
+ *
+ * cancel() stops a group once its answer is known: tasks that have not
+ * started are skipped (still releasing their scope_waiter, so the join
+ * completes right away) and running ones can poll token(). The flag
+ * clears at the next join, so the group can be reused.
+ *
+ * A child scope, built from a parent, counts its own tasks and holds a
+ * single registration on the parent while it has any pending (taken on
+ * its 0 -> 1 transition, dropped on 1 -> 0, as in a SNZI tree). Tasks that
+ * register and finish on the child thus never touch the parent's counter
+ * unless the child drains completely. Otherwise a child is part of its
+ * parent's group: it shares the executor, cancellation and error policy,
+ * and exceptions are rethrown by the outermost scope's wait_for_all.
+ *
+ * set_stats attaches a task_stats to the whole group, children included:
+ * every task that runs records its queue and run time there. Attach it
+ * before spawning; tasks registered earlier are not timed.
+ */
+struct synched_t
 {
-    template < typename function_t, typename... ArgsT, typename... Args >
-    static void applyTuple( function_t f,
-                            const std::tuple<ArgsT...>& t,
-                            Args... args )
+    enum join_mode
+    {
+        join_auto,
+        join_park,
+        join_help
+    };
+
+    enum error_policy
+    {
+        error_continue,
+        error_cancel
+    };
+
+    enum join_status
+    {
+        join_done,
+        join_timeout
+    };
+
+    enum timeout_policy
+    {
+        timeout_return,
+        timeout_cancel
+    };
+
+    explicit synched_t(join_mode mode = join_auto, error_policy policy = error_continue,
+            executor& exec = default_executor())
+            : m_mode(mode), m_policy(policy), mr_executor(exec), mp_parent(NULL), mp_group(this), mp_resume(NULL),
+              mp_stats(NULL), m_state(0), m_error_claimed(false), m_cancelled(false)
     {
-        apply_obj_func<N-1>::applyTuple( f, t, std::get<N-1>( t ), args... );
     }
-};
 
-template <>
-struct apply_obj_func<0>
-{
-    template < typename function_t, typename... ArgsT, typename... Args >
-    static void applyTuple( function_t f,
-                            const std::tuple<ArgsT...>& /* t */,
-                            Args... args )
+    explicit synched_t(synched_t& parent, join_mode mode = join_auto)
+            : m_mode(mode), m_policy(parent.m_policy), mr_executor(parent.mr_executor),
+              mp_parent(&parent), mp_group(parent.mp_group), mp_resume(NULL), mp_stats(NULL), m_state(0),
+              m_error_claimed(false), m_cancelled(false)
     {
-        f( args... );
     }
-};
 
-struct parallel
-{
-    template <typename synched_t, typename function_t>
-    parallel (synched_t& sb, function_t func)
+    executor& get_executor() const
     {
-        contended_caller<function_t>& cc = * new (tbb::task::allocate_root()) contended_caller<function_t>(sb, func);
-        tbb::task::spawn(cc);
+        return mr_executor;
     }
 
-    template < typename function_t>
-    parallel (function_t func)
+    scope_waiter register_lock()
     {
-        simple_caller<function_t>& sc = * new (tbb::task::allocate_root()) simple_caller<function_t>(func);
-        tbb::task::spawn(sc);
+        register_pending();
+        return scope_waiter(*this);
     }
-    
-    
-    template <typename synched_t, typename function_t, typename... parameters>
-    parallel(synched_t& sb, function_t f, parameters... params)
+
+    void cancel()
+    {
+        mp_group->m_cancelled = true;
+    }
+
+    bool cancelled() const
+    {
+        return mp_group->m_cancelled.load(std::memory_order_relaxed);
+    }
+
+    // Refers to this group's flag: do not keep it past the group.
+    cancellation_token token() const
+    {
+        return cancellation_token(mp_group->m_cancelled);
+    }
+
+    void set_stats(task_stats* stats)
+    {
+        mp_group->mp_stats = stats;
+    }
+
+    task_stats* stats() const
+    {
+        return mp_group->mp_stats;
+    }
+
+    // Joins, then rethrows the first exception any task threw.
+    void wait_for_all()
     {
-        class forwarded_callable : public tbb::task
         {
-        public:
-            forwarded_callable(synched_t& sb, function_t f, parameters... p)
-                    : m_function(f), m_parameters(p...), m_sw(sb.register_lock())
+#ifdef CPP_UTILS_TRACE
+            trace::detail::join_scope traced(this);
+#endif
+            join_blocking();
+        }
+
+        rethrow_error();
+    }
+
+    /*
+     * co_await synch.join() is wait_for_all for coroutines: instead of
+     * blocking the thread it suspends the coroutine, and the last task of
+     * the group spawns its resumption on the group's executor. Do not mix
+     * it with a blocking join of the same group at the same time.
+     */
+    class join_awaiter
+    {
+    public:
+        explicit join_awaiter(synched_t& sb)
+                : mr_sb(sb)
+        {
+        }
+
+        bool await_ready() const
+        {
+            return (mr_sb.m_state & pending_mask) == 0;
+        }
+
+        // Works with any coroutine handle type; returns false to carry on
+        // without suspending when the group drained in the meantime.
+        template <typename handle_t>
+        bool await_suspend(handle_t handle)
+        {
+            detail::resume_task<handle_t>* resume = new detail::resume_task<handle_t>(handle);
+
+            if (mr_sb.resume_when_done(*resume))
+                return true;
+
+            delete resume;
+            return false;
+        }
+
+        void await_resume()
+        {
+            int awaiting = awaiting_flag;
+            mr_sb.m_state.compare_exchange_strong(awaiting, 0);
+
+            mr_sb.end_join();
+            mr_sb.rethrow_error();
+        }
+
+    private:
+        synched_t& mr_sb;
+    };
+
+    join_awaiter join()
+    {
+        return join_awaiter(*this);
+    }
+
+    /*
+     * Like wait_for_all, but gives up at the deadline and returns
+     * join_timeout; with timeout_cancel it also cancels the group, so tasks
+     * that have not started yet are skipped. Tasks still running keep
+     * using the group, which must therefore still be joined (the
+     * destructor does) before it goes away. A timed wait always parks:
+     * helping could not let go of the thread in time.
+     */
+    template <typename clock_t, typename duration_t>
+    join_status wait_until(const std::chrono::time_point<clock_t, duration_t>& deadline,
+            timeout_policy policy = timeout_return)
+    {
+#ifdef CPP_UTILS_TRACE
+        trace::detail::join_scope traced(this);
+#endif
+
+        if (!park_until(deadline))
+        {
+            if (policy == timeout_cancel)
+                cancel();
+            return join_timeout;
+        }
+
+        end_join();
+        rethrow_error();
+        return join_done;
+    }
+
+    template <typename rep_t, typename period_t>
+    join_status wait_for(const std::chrono::duration<rep_t, period_t>& timeout,
+            timeout_policy policy = timeout_return)
+    {
+        return wait_until(std::chrono::steady_clock::now() + timeout, policy);
+    }
+
+    ~synched_t()
+    {
+        // Too late to report anything; a stored exception is dropped.
+        join_blocking();
+        mr_executor.release_help(m_help);
+    }
+
+protected:
+    friend struct scope_waiter;
+
+    void join_blocking()
+    {
+        if (m_mode == join_help || (m_mode == join_auto && detail::in_task()))
+            help_while_waiting();
+        else
+            park_while_waiting();
+
+        end_join();
+    }
+
+    void end_join()
+    {
+        if (mp_group == this)
+            m_cancelled = false;
+    }
+
+    void rethrow_error()
+    {
+        if (m_error_claimed)
+        {
+            std::exception_ptr error;
+
+            std::swap(error, m_error);
+            m_error_claimed = false;
+            std::rethrow_exception(error);
+        }
+    }
+
+    void capture_exception(std::exception_ptr error)
+    {
+        if (mp_group != this)
+        {
+            mp_group->capture_exception(error);
+            return;
+        }
+
+        // Stored before this task's release, which the join waits for.
+        if (!m_error_claimed.exchange(true))
+            m_error = error;
+
+        if (m_policy == error_cancel)
+            m_cancelled = true;
+    }
+
+    enum
+    {
+        parked_flag = INT_MIN,
+        helping_flag = 1 << 30,
+        awaiting_flag = 1 << 29,
+        pending_mask = awaiting_flag - 1
+    };
+
+    // Has resume spawned once nothing is pending; false, leaving resume
+    // alone, when nothing is pending already.
+    bool resume_when_done(task_base& resume)
+    {
+        mp_resume = &resume;
+
+        for (;;)
+        {
+            int state = m_state;
+
+            if ((state & pending_mask) == 0)
+            {
+                mp_resume = NULL;
+                return false;
+            }
+
+            if (m_state.compare_exchange_weak(state, state | awaiting_flag))
+                return true;
+        }
+    }
+
+    void park_while_waiting()
+    {
+        detail::backoff backoff;
+
+        for (;;)
+        {
+            int state = m_state;
+
+            if ((state & pending_mask) == 0)
+            {
+                // Nothing is pending any more, so only we can own the flag.
+                if (state & parked_flag)
+                    m_state.compare_exchange_strong(state, 0);
+                break;
+            }
+
+            if (backoff.pause())
+                continue;
+
+            if (!(state & parked_flag) && !m_state.compare_exchange_weak(state, state | parked_flag))
+                continue;
+
+            detail::futex_wait(m_state, state | parked_flag);
+        }
+    }
+
+    // park_while_waiting with a deadline; false when it passed first.
+    template <typename clock_t, typename duration_t>
+    bool park_until(const std::chrono::time_point<clock_t, duration_t>& deadline)
+    {
+        detail::backoff backoff;
+
+        for (;;)
+        {
+            int state = m_state;
+
+            if ((state & pending_mask) == 0)
             {
+                if (state & parked_flag)
+                    m_state.compare_exchange_strong(state, 0);
+                return true;
             }
 
-            tbb::task* execute()
+            if (backoff.pause())
+                continue;
+
+            typename clock_t::duration remaining = deadline - clock_t::now();
+
+            if (remaining <= clock_t::duration::zero())
             {
-                apply_obj_func<sizeof... (parameters) >::applyTuple(m_function, m_parameters);
-                return NULL;
+                // Leave no flag behind; the next join may want to help.
+                if (!(state & parked_flag) || m_state.compare_exchange_weak(state, state & ~parked_flag))
+                    return false;
+                continue;
             }
 
-            std::tuple<parameters...> m_parameters;
-            function_t m_function;
-            scope_waiter m_sw;
-        };
+            if (!(state & parked_flag) && !m_state.compare_exchange_weak(state, state | parked_flag))
+                continue;
 
-        forwarded_callable& sc = * new (tbb::task::allocate_root()) forwarded_callable(sb, f, params...);
-        tbb::task::spawn(sc);
+            detail::futex_wait_for(m_state, state | parked_flag, remaining);
+        }
     }
 
-    template <typename function_t, typename... parameters>
-    parallel(function_t f, parameters... params)
+    void help_while_waiting()
     {
-        class forwarded_callable : public tbb::task
+        if ((m_state & pending_mask) == 0)
+            return;
+
+        // Armed before the flag is published, since release() may call
+        // finish_help as soon as it sees it.
+        mr_executor.prepare_help(m_help);
+
+        for (;;)
         {
-        public:
-            forwarded_callable(function_t f, parameters... p)
-                    : m_function(f), m_parameters(p...)
+            int state = m_state;
+
+            if ((state & pending_mask) == 0)
             {
+                mr_executor.finish_help(m_help);
+                break;
             }
 
-            tbb::task* execute()
+            if (m_state.compare_exchange_weak(state, state | helping_flag))
+                break;
+        }
+
+        mr_executor.help(m_help);
+
+        int helping = helping_flag;
+        m_state.compare_exchange_strong(helping, 0);
+    }
+
+    // Child scopes only: registers one task, taking a registration on the
+    // parent first when the count is about to leave zero. Losing the race
+    // to another first registration hands the parent's back.
+    void arrive()
+    {
+        int state = m_state.load(std::memory_order_relaxed);
+
+        for (;;)
+        {
+            if ((state & pending_mask) != 0)
             {
-                apply_obj_func<sizeof... (parameters) >::applyTuple(m_function, m_parameters);
-                return NULL;
+                if (m_state.compare_exchange_weak(state, state + 1))
+                    return;
+                continue;
             }
 
-            std::tuple<parameters...> m_parameters;
-            function_t m_function;
-        };
+            mp_parent->register_pending();
+
+            if (m_state.compare_exchange_strong(state, state + 1))
+                return;
+
+            mp_parent->release();
+        }
+    }
+
+    void register_pending()
+    {
+        if (mp_parent)
+            arrive();
+        else
+            m_state++;
+    }
+
+    void release()
+    {
+        // The decrement is the last access to *this: once the count is zero
+        // the joining thread may return and destroy us. futex_wake only uses
+        // the address, so waking after that point is harmless. A helping
+        // waiter cannot leave before finish_help, which keeps the executor
+        // and m_help valid until then; an awaiting coroutine stays
+        // suspended until its resume task runs. A child's parent outlives
+        // the registration we still hold on it.
+        synched_t* parent = mp_parent;
+        int state = m_state.fetch_sub(1);
+
+        if (state == (parked_flag | 1))
+            detail::futex_wake(m_state, INT_MAX);
+        else if (state == (helping_flag | 1))
+            mr_executor.finish_help(m_help);
+        else if (state == (awaiting_flag | 1))
+            mr_executor.spawn(*mp_resume);
 
-        forwarded_callable& sc = * new (tbb::task::allocate_root()) forwarded_callable(f, params...);
-        tbb::task::spawn(sc);
+        if (parent && (state & pending_mask) == 1)
+            parent->release();
     }
+
+    join_mode m_mode;
+    error_policy m_policy;
+    executor& mr_executor;
+    synched_t* mp_parent;
+    synched_t* mp_group;
+    task_base* mp_resume;
+    task_stats* mp_stats;
+    help_state m_help;
+    std::atomic<int> m_state;
+    std::atomic<bool> m_error_claimed;
+    std::atomic<bool> m_cancelled;
+    std::exception_ptr m_error;
 };
 
+inline scope_waiter::scope_waiter(synched_t& sb)
+        : mp_sb(&sb), m_queued(sb.stats() ? detail::ticks() : 0)
+{
+}
+
+inline scope_waiter::~scope_waiter()
+{
+    if (mp_sb)
+        mp_sb->release();
+}
+
+inline void scope_waiter::capture_exception(std::exception_ptr error)
+{
+    mp_sb->capture_exception(error);
+}
+
+inline bool scope_waiter::cancelled() const
+{
+    return mp_sb->cancelled();
+}
+
+inline const std::atomic<bool>* scope_waiter::cancel_flag() const
+{
+    return &mp_sb->mp_group->m_cancelled;
+}
+
+inline task_stats* scope_waiter::stats() const
+{
+    return mp_sb->stats();
+}
+
+/*
+ * A synched_t for fan-outs from many threads at once: registrations go to
+ * one of several child scopes, picked by the registering thread, so the
+ * root counter only moves when a whole child fills up or drains. Usable
+ * wherever a synched_t is.
+ */
+class synched_tree_t
+{
+public:
+    explicit synched_tree_t(synched_t::join_mode mode = synched_t::join_auto,
+            synched_t::error_policy policy = synched_t::error_continue, executor& exec = default_executor())
+            : m_root(mode, policy, exec)
+    {
+        unsigned int leaves = std::max(1u, exec.concurrency());
+
+        for (unsigned int i = 0; i < leaves; ++i)
+            m_leaves.push_back(std::unique_ptr<leaf>(new leaf(m_root)));
+    }
+
+    executor& get_executor() const
+    {
+        return m_root.get_executor();
+    }
+
+    scope_waiter register_lock()
+    {
+        return m_leaves[detail::thread_id() % m_leaves.size()]->m_scope.register_lock();
+    }
+
+    void cancel()
+    {
+        m_root.cancel();
+    }
+
+    bool cancelled() const
+    {
+        return m_root.cancelled();
+    }
+
+    cancellation_token token() const
+    {
+        return m_root.token();
+    }
+
+    void set_stats(task_stats* stats)
+    {
+        m_root.set_stats(stats);
+    }
+
+    task_stats* stats() const
+    {
+        return m_root.stats();
+    }
+
+    void wait_for_all()
+    {
+        m_root.wait_for_all();
+    }
+
+    template <typename clock_t, typename duration_t>
+    synched_t::join_status wait_until(const std::chrono::time_point<clock_t, duration_t>& deadline,
+            synched_t::timeout_policy policy = synched_t::timeout_return)
+    {
+        return m_root.wait_until(deadline, policy);
+    }
+
+    template <typename rep_t, typename period_t>
+    synched_t::join_status wait_for(const std::chrono::duration<rep_t, period_t>& timeout,
+            synched_t::timeout_policy policy = synched_t::timeout_return)
+    {
+        return m_root.wait_for(timeout, policy);
+    }
+
+private:
+    synched_tree_t(const synched_tree_t&);
+    synched_tree_t& operator=(const synched_tree_t&);
+
+    // Padded so that neighbouring leaves do not share a cache line.
+    struct leaf
+    {
+        explicit leaf(synched_t& root)
+                : m_scope(root)
+        {
+        }
+
+        synched_t m_scope;
+        char m_pad[64];
+    };
+
+    synched_t m_root;
+    std::vector<std::unique_ptr<leaf> > m_leaves;
+};
+
+/*
+ * Admission limit for fire-and-forget tasks: at most max_in_flight tasks
+ * spawned through it are queued or running at any time. What happens to
+ * one more depends on the policy: admit_block makes the caller wait for a
+ * slot, admit_inline has the caller run the task itself, and admit_reject
+ * throws admission_rejected. A task inside the pool is never blocked (the
+ * tasks it would wait for may be queued behind it on its own worker), so
+ * admit_block runs it inline there.
+ *
+ * Give it to parallel as the first argument for a named limit, or install
+ * one for every unsynchronised parallel with set_default_admission_limit.
+ * The limit has to outlive the tasks spawned through it.
+ *
+ * The in-flight count and a sleepers bit share one futex word. A task
+ * frees its memory before giving its slot back, so the limit also bounds
+ * what the tasks hold.
+ */
+class admission_rejected : public std::runtime_error
+{
+public:
+    admission_rejected()
+            : std::runtime_error("admission_limit: too many tasks in flight")
+    {
+    }
+};
+
+class admission_limit
+{
+public:
+    enum overload_policy
+    {
+        admit_block, admit_inline, admit_reject
+    };
+
+    explicit admission_limit(unsigned int max_in_flight, overload_policy policy = admit_block,
+            executor& exec = default_executor())
+            : m_count(0), m_max(int(std::min(max_in_flight, unsigned(count_mask)))), m_policy(policy),
+              mr_executor(exec)
+    {
+    }
+
+    // True when the caller got a slot and may spawn; false when it has to
+    // run the task itself.
+    bool enter()
+    {
+        int current = m_count.load(std::memory_order_relaxed);
+        detail::backoff backoff;
+
+        for (;;)
+        {
+            if ((current & count_mask) < m_max)
+            {
+                if (m_count.compare_exchange_weak(current, current + 1, std::memory_order_acquire,
+                        std::memory_order_relaxed))
+                    return true;
+
+                continue;
+            }
+
+            if (m_policy == admit_reject)
+                throw admission_rejected();
+
+            if (m_policy == admit_inline || detail::in_task())
+                return false;
+
+            if (backoff.pause())
+            {
+                current = m_count.load(std::memory_order_relaxed);
+                continue;
+            }
+
+            if (!(current & sleepers_flag)
+                    && !m_count.compare_exchange_weak(current, current | sleepers_flag, std::memory_order_relaxed))
+                continue;
+
+            detail::futex_wait(m_count, current | sleepers_flag);
+            current = m_count.load(std::memory_order_relaxed);
+        }
+    }
+
+    // Gives a slot back. Sleepers are all woken and race for the free
+    // slots; whoever loses sets the bit again.
+    void leave()
+    {
+        if (m_count.fetch_sub(1, std::memory_order_release) & sleepers_flag)
+        {
+            m_count.fetch_and(count_mask, std::memory_order_relaxed);
+            detail::futex_wake(m_count, INT_MAX);
+        }
+    }
+
+    unsigned int in_flight() const
+    {
+        return unsigned(m_count.load(std::memory_order_relaxed) & count_mask);
+    }
+
+    executor& get_executor()
+    {
+        return mr_executor;
+    }
+
+private:
+    admission_limit(const admission_limit&);
+    admission_limit& operator=(const admission_limit&);
+
+    enum
+    {
+        sleepers_flag = INT_MIN,
+        count_mask = INT_MAX
+    };
+
+    std::atomic<int> m_count;
+    int m_max;
+    overload_policy m_policy;
+    executor& mr_executor;
+};
+
+namespace detail
+{
+
+inline std::atomic<admission_limit*>& default_admission_slot()
+{
+    static std::atomic<admission_limit*> slot(NULL);
+    return slot;
+}
+
+} // namespace detail
+
+// Limit for every parallel() without a group or a limit of its own; NULL
+// (the default) leaves them unbounded.
+inline void set_default_admission_limit(admission_limit* limit)
+{
+    detail::default_admission_slot().store(limit, std::memory_order_release);
+}
+
+typedef void (*unhandled_exception_handler)(std::exception_ptr);
+
+namespace detail
+{
+
+inline std::atomic<unhandled_exception_handler>& unhandled_exception_slot()
+{
+    static std::atomic<unhandled_exception_handler> slot(NULL);
+    return slot;
+}
+
+// For tasks with no group to hand their exception to.
+inline void unhandled_task_exception(std::exception_ptr error)
+{
+    if (unhandled_exception_handler handler = unhandled_exception_slot().load(std::memory_order_acquire))
+        handler(error);
+    else
+        std::terminate();
+}
+
+} // namespace detail
+
+// Called on the worker with whatever a task spawned without a group threw.
+// NULL (the default) calls std::terminate, as an exception leaving a
+// std::thread does; a handler that throws terminates too.
+inline void set_unhandled_exception_handler(unhandled_exception_handler handler)
+{
+    detail::unhandled_exception_slot().store(handler, std::memory_order_release);
+}
+
+template < typename function_t>
+class contended_caller : public task_base
+{
+public:
+    template <typename synched_t, typename F>
+    contended_caller(synched_t& sb, F&& func)
+            : m_sw(sb.register_lock()) , m_func(std::forward<F>(func))
+    {
+    }
+
+    void execute()
+    {
+        detail::task_scope scope(m_sw.cancel_flag());
+
+        if (m_sw.cancelled())
+            return;
+
+        detail::stats_scope timed(m_sw);
+
+        try
+        {
+            m_func();
+        }
+        catch (...)
+        {
+            m_sw.capture_exception(std::current_exception());
+        }
+    }
+
+    scope_waiter m_sw;
+    function_t m_func;
+};
+
+template <typename function_t>
+class simple_caller : public task_base
+{
+public:
+    template <typename F>
+    explicit simple_caller(F&& func)
+            :  m_func(std::forward<F>(func))
+    {
+    }
+
+    void execute()
+    {
+        detail::task_scope scope;
+
+        try
+        {
+            m_func();
+        }
+        catch (...)
+        {
+            detail::unhandled_task_exception(std::current_exception());
+        }
+    }
+
+    function_t m_func;
+};
+
+template <typename function_t>
+class limited_caller : public task_base
+{
+public:
+    template <typename F>
+    limited_caller(admission_limit& limit, F&& func)
+            : mr_limit(limit), m_func(std::forward<F>(func))
+    {
+    }
+
+    void execute()
+    {
+        detail::task_scope scope;
+
+        try
+        {
+            m_func();
+        }
+        catch (...)
+        {
+            detail::unhandled_task_exception(std::current_exception());
+        }
+    }
+
+    void release()
+    {
+        admission_limit& limit = mr_limit;
+
+        delete this;
+        limit.leave();
+    }
+
+    admission_limit& mr_limit;
+    function_t m_func;
+};
+
+namespace detail
+{
+
+// Calls f with the tuple elements moved out; a task runs exactly once, so
+// its captured arguments are never needed again. A callable that takes
+// non-const references, such as void inc(int&), cannot bind rvalues and
+// gets the stored copies as lvalues instead.
+template <typename function_t, typename tuple_t, std::size_t... I>
+auto apply_tuple(function_t& f, tuple_t& t, std::index_sequence<I...>, int)
+        -> decltype(f(std::get<I>(std::move(t))...))
+{
+    return f(std::get<I>(std::move(t))...);
+}
+
+template <typename function_t, typename tuple_t, std::size_t... I>
+auto apply_tuple(function_t& f, tuple_t& t, std::index_sequence<I...>, long)
+        -> decltype(f(std::get<I>(t)...))
+{
+    return f(std::get<I>(t)...);
+}
+
+template <typename function_t, typename... Args>
+auto apply_tuple(function_t& f, std::tuple<Args...>& t)
+        -> decltype(apply_tuple(f, t, std::index_sequence_for<Args...>(), 0))
+{
+    return apply_tuple(f, t, std::index_sequence_for<Args...>(), 0);
+}
+
+// The callable and its arguments packed into a nullary callable, stored
+// and moved out on the call like parallel does.
+template <typename function_t, typename... parameters>
+auto bind_call(function_t&& f, parameters&&... params)
+{
+    return [function = std::decay_t<function_t>(std::forward<function_t>(f)),
+            arguments = std::tuple<std::decay_t<parameters>...>(std::forward<parameters>(params)...)]() mutable
+    {
+        apply_tuple(function, arguments);
+    };
+}
+
+// hint is a task_priority or a placement, whichever the caller gave.
+template <typename hint_t, typename function_t, typename... parameters>
+void spawn_limited(admission_limit& limit, hint_t hint, function_t&& f, parameters&&... params)
+{
+    if (!limit.enter())
+    {
+        std::forward<function_t>(f)(std::forward<parameters>(params)...);
+        return;
+    }
+
+    typedef decltype(bind_call(std::forward<function_t>(f), std::forward<parameters>(params)...)) call_t;
+
+    limit.get_executor().spawn(* new limited_caller<call_t>(limit,
+            bind_call(std::forward<function_t>(f), std::forward<parameters>(params)...)), hint);
+}
+
+// Anything with register_lock() can stand in for a synched_t.
+template <typename T, typename = void>
+struct is_synched : std::false_type
+{
+};
+
+template <typename T>
+struct is_synched<T, decltype(void(std::declval<T&>().register_lock()))> : std::true_type
+{
+};
+
+template <typename T>
+using enable_if_synched = typename std::enable_if<is_synched<T>::value, int>::type;
+
+} // namespace detail
+
+/*
+ * The callable and its arguments are taken by forwarding reference and
+ * stored decayed, so rvalues are moved into the task and lvalues copied
+ * exactly once; on execution the arguments are moved out again. Large
+ * buffers thus travel without copies, and move-only types such as
+ * std::unique_ptr can be passed.
+ */
+struct parallel
+{
+    template <typename synched_t, typename function_t, detail::enable_if_synched<synched_t> = 0>
+    parallel (synched_t& sb, function_t&& func)
+    {
+        typedef contended_caller<std::decay_t<function_t> > caller_t;
+
+        caller_t& cc = * new caller_t(sb, std::forward<function_t>(func));
+        sb.get_executor().spawn(cc);
+    }
+
+    template < typename function_t>
+    parallel (function_t&& func)
+    {
+        if (admission_limit* limit = detail::default_admission_slot().load(std::memory_order_acquire))
+        {
+            detail::spawn_limited(*limit, priority_normal, std::forward<function_t>(func));
+            return;
+        }
+
+        typedef simple_caller<std::decay_t<function_t> > caller_t;
+
+        caller_t& sc = * new caller_t(std::forward<function_t>(func));
+        default_executor().spawn(sc);
+    }
+    
+    
+    template <typename synched_t, typename function_t, typename... parameters, detail::enable_if_synched<synched_t> = 0>
+    parallel(synched_t& sb, function_t&& f, parameters&&... params)
+    {
+        class forwarded_callable : public task_base
+        {
+        public:
+            forwarded_callable(synched_t& sb, function_t&& f, parameters&&... p)
+                    : m_function(std::forward<function_t>(f)), m_parameters(std::forward<parameters>(p)...),
+                      m_sw(sb.register_lock())
+            {
+            }
+
+            void execute()
+            {
+                detail::task_scope scope(m_sw.cancel_flag());
+
+                if (m_sw.cancelled())
+                    return;
+
+                detail::stats_scope timed(m_sw);
+
+                try
+                {
+                    detail::apply_tuple(m_function, m_parameters);
+                }
+                catch (...)
+                {
+                    m_sw.capture_exception(std::current_exception());
+                }
+            }
+
+            std::decay_t<function_t> m_function;
+            std::tuple<std::decay_t<parameters>...> m_parameters;
+            scope_waiter m_sw;
+        };
+
+        forwarded_callable& sc = * new forwarded_callable(sb, std::forward<function_t>(f), std::forward<parameters>(params)...);
+        sb.get_executor().spawn(sc);
+    }
+
+    template <typename function_t, typename... parameters>
+    parallel(function_t&& f, parameters&&... params)
+    {
+        if (admission_limit* limit = detail::default_admission_slot().load(std::memory_order_acquire))
+        {
+            detail::spawn_limited(*limit, priority_normal, std::forward<function_t>(f), std::forward<parameters>(params)...);
+            return;
+        }
+
+        class forwarded_callable : public task_base
+        {
+        public:
+            forwarded_callable(function_t&& f, parameters&&... p)
+                    : m_function(std::forward<function_t>(f)), m_parameters(std::forward<parameters>(p)...)
+            {
+            }
+
+            void execute()
+            {
+                detail::task_scope scope;
+
+                try
+                {
+                    detail::apply_tuple(m_function, m_parameters);
+                }
+                catch (...)
+                {
+                    detail::unhandled_task_exception(std::current_exception());
+                }
+            }
+
+            std::decay_t<function_t> m_function;
+            std::tuple<std::decay_t<parameters>...> m_parameters;
+        };
+
+        forwarded_callable& sc = * new forwarded_callable(std::forward<function_t>(f), std::forward<parameters>(params)...);
+        default_executor().spawn(sc);
+    }
+
+    // Bounded by the given limit and run on its executor.
+    template <typename function_t, typename... parameters>
+    parallel(admission_limit& limit, function_t&& f, parameters&&... params)
+    {
+        detail::spawn_limited(limit, priority_normal, std::forward<function_t>(f), std::forward<parameters>(params)...);
+    }
+
+    // The same with a hint in front, a task_priority or a placement:
+    // parallel(priority_high, synch, f, args...) or
+    // parallel(placement::near(data), synch, f, data).
+    template <typename synched_t, typename function_t, typename... parameters, detail::enable_if_synched<synched_t> = 0>
+    parallel(task_priority priority, synched_t& sb, function_t&& f, parameters&&... params)
+    {
+        spawn_grouped(priority, sb, std::forward<function_t>(f), std::forward<parameters>(params)...);
+    }
+
+    template <typename function_t, typename... parameters>
+    parallel(task_priority priority, function_t&& f, parameters&&... params)
+    {
+        spawn_free(priority, std::forward<function_t>(f), std::forward<parameters>(params)...);
+    }
+
+    template <typename function_t, typename... parameters>
+    parallel(task_priority priority, admission_limit& limit, function_t&& f, parameters&&... params)
+    {
+        detail::spawn_limited(limit, priority, std::forward<function_t>(f), std::forward<parameters>(params)...);
+    }
+
+    template <typename synched_t, typename function_t, typename... parameters, detail::enable_if_synched<synched_t> = 0>
+    parallel(placement where, synched_t& sb, function_t&& f, parameters&&... params)
+    {
+        spawn_grouped(where, sb, std::forward<function_t>(f), std::forward<parameters>(params)...);
+    }
+
+    template <typename function_t, typename... parameters>
+    parallel(placement where, function_t&& f, parameters&&... params)
+    {
+        spawn_free(where, std::forward<function_t>(f), std::forward<parameters>(params)...);
+    }
+
+    template <typename function_t, typename... parameters>
+    parallel(placement where, admission_limit& limit, function_t&& f, parameters&&... params)
+    {
+        detail::spawn_limited(limit, where, std::forward<function_t>(f), std::forward<parameters>(params)...);
+    }
+
+private:
+    template <typename hint_t, typename synched_t, typename function_t, typename... parameters>
+    static void spawn_grouped(hint_t hint, synched_t& sb, function_t&& f, parameters&&... params)
+    {
+        typedef decltype(detail::bind_call(std::forward<function_t>(f), std::forward<parameters>(params)...)) call_t;
+
+        sb.get_executor().spawn(* new contended_caller<call_t>(sb,
+                detail::bind_call(std::forward<function_t>(f), std::forward<parameters>(params)...)), hint);
+    }
+
+    template <typename hint_t, typename function_t, typename... parameters>
+    static void spawn_free(hint_t hint, function_t&& f, parameters&&... params)
+    {
+        if (admission_limit* limit = detail::default_admission_slot().load(std::memory_order_acquire))
+        {
+            detail::spawn_limited(*limit, hint, std::forward<function_t>(f), std::forward<parameters>(params)...);
+            return;
+        }
+
+        typedef decltype(detail::bind_call(std::forward<function_t>(f), std::forward<parameters>(params)...)) call_t;
+
+        default_executor().spawn(* new simple_caller<call_t>(
+                detail::bind_call(std::forward<function_t>(f), std::forward<parameters>(params)...)), hint);
+    }
+};
+
+namespace detail
+{
+
+/*
+ * One allocation for a whole parallel_batch: the shared callable, a single
+ * registration on the group, and the task descriptors laid out right
+ * behind them. Each descriptor runs f(index) and counts the block down;
+ * the last one out destroys it, which releases the group.
+ */
+template <typename function_t>
+class batch_block
+{
+public:
+    template <typename synched_t, typename F>
+    static batch_block* create(synched_t& sb, std::size_t count, F&& f)
+    {
+        static_assert(alignof(batch_block) <= alignof(std::max_align_t),
+                "task_pool blocks are only aligned for std::max_align_t; wrap over-aligned callables in a pointer");
+
+        void* memory = task_pool::allocate(bytes(count));
+        return new (memory) batch_block(sb, count, std::forward<F>(f));
+    }
+
+    void spawn_on(executor& exec)
+    {
+        task_list list;
+
+        for (std::size_t i = 0; i < m_count; ++i)
+            list.push_back(items()[i]);
+
+        exec.spawn(list);
+    }
+
+private:
+    class item : public task_base
+    {
+    public:
+        item(batch_block& block, std::size_t index)
+                : mr_block(block), m_index(index)
+        {
+        }
+
+    protected:
+        void execute()
+        {
+            mr_block.run(m_index);
+        }
+
+        // The block owns the memory; the last item frees all of it.
+        void release()
+        {
+            mr_block.finished();
+        }
+
+    private:
+        batch_block& mr_block;
+        std::size_t m_index;
+    };
+
+    template <typename synched_t, typename F>
+    batch_block(synched_t& sb, std::size_t count, F&& f)
+            : m_sw(sb.register_lock()), m_function(std::forward<F>(f)), m_count(count), m_remaining(count)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+            new (&items()[i]) item(*this, i);
+    }
+
+    ~batch_block()
+    {
+        for (std::size_t i = 0; i < m_count; ++i)
+            items()[i].~item();
+    }
+
+    static std::size_t header_size()
+    {
+        return (sizeof(batch_block) + alignof(item) - 1) / alignof(item) * alignof(item);
+    }
+
+    static std::size_t bytes(std::size_t count)
+    {
+        return header_size() + count * sizeof(item);
+    }
+
+    item* items()
+    {
+        return reinterpret_cast<item*>(reinterpret_cast<char*>(this) + header_size());
+    }
+
+    void run(std::size_t index)
+    {
+        detail::task_scope scope(m_sw.cancel_flag());
+
+        if (m_sw.cancelled())
+            return;
+
+        detail::stats_scope timed(m_sw);
+
+        try
+        {
+            m_function(index);
+        }
+        catch (...)
+        {
+            m_sw.capture_exception(std::current_exception());
+        }
+    }
+
+    void finished()
+    {
+        if (--m_remaining != 0)
+            return;
+
+        std::size_t count = m_count;
+        this->~batch_block();
+        task_pool::deallocate(this, bytes(count));
+    }
+
+    scope_waiter m_sw;
+    function_t m_function;
+    std::size_t m_count;
+    std::atomic<std::size_t> m_remaining;
+};
+
+} // namespace detail
+
+/*
+ * Runs f(i) for every i in [0, count) as count separate tasks on sb, for
+ * fan-outs where a loop of parallel() calls would pay per task for the
+ * registration, the allocation and the spawn. Here the group is joined
+ * once, the descriptors share one block and the executor receives them as
+ * a single list. Unlike parallel_for nothing is chunked: every index is
+ * its own task.
+ */
+template <typename synched_t, typename function_t, detail::enable_if_synched<synched_t> = 0>
+void parallel_batch(synched_t& sb, std::size_t count, function_t&& f)
+{
+    if (count == 0)
+        return;
+
+    detail::batch_block<std::decay_t<function_t> >* block =
+            detail::batch_block<std::decay_t<function_t> >::create(sb, count, std::forward<function_t>(f));
+    block->spawn_on(sb.get_executor());
+}
+
+namespace detail
+{
+
+/*
+ * Chunk size control shared by every task of one parallel_for. Each chunk
+ * is timed and the grain is scaled towards target_chunk_time, at most
+ * doubling or halving per sample, so cheap bodies end up in large chunks
+ * (few spawns) and expensive ones in small chunks (good balance). Only
+ * full chunks count, and only while the grain they ran with is still the
+ * current one: a remainder clipped by the end of the range says nothing
+ * about the grain, and a sample taken under an older grain would scale
+ * twice.
+ */
+template <typename chunk_t>
+class range_state
+{
+public:
+    typedef std::chrono::steady_clock clock;
+
+    enum { target_chunk_ns = 100 * 1000 };
+
+    range_state(chunk_t&& chunk, std::size_t size, unsigned int workers, placement where)
+            : m_chunk(std::move(chunk)), m_where(where)
+    {
+        // Start at a few chunks per worker; timing corrects it from there.
+        m_grain.store(std::max<std::size_t>(1, size / (4 * std::max(1u, workers))), std::memory_order_relaxed);
+    }
+
+    std::size_t grain() const
+    {
+        return m_grain.load(std::memory_order_relaxed);
+    }
+
+    // Time taken by a full chunk of grain elements.
+    void record(std::size_t grain, clock::duration elapsed)
+    {
+        long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+        std::size_t scaled;
+
+        if (ns * 2 < target_chunk_ns)
+            scaled = grain * 2;
+        else if (ns > 2LL * target_chunk_ns)
+            scaled = std::max<std::size_t>(1, grain / 2);
+        else
+            return;
+
+        m_grain.compare_exchange_strong(grain, scaled, std::memory_order_relaxed);
+    }
+
+    chunk_t m_chunk;
+    placement m_where;
+
+private:
+    std::atomic<std::size_t> m_grain;
+};
+
+// Every piece of a placed loop keeps the loop's placement.
+template <typename synched_t, typename task_t>
+void spawn_placed(placement where, synched_t& sb, task_t&& task)
+{
+    if (where.anywhere())
+        parallel(sb, std::forward<task_t>(task));
+    else
+        parallel(where, sb, std::forward<task_t>(task));
+}
+
+template <typename synched_t, typename index_t, typename chunk_t>
+class range_task
+{
+public:
+    typedef range_state<chunk_t> state_t;
+
+    range_task(synched_t& sb, const std::shared_ptr<state_t>& state, index_t begin, index_t end)
+            : mp_sb(&sb), m_state(state), m_begin(begin), m_end(end)
+    {
+    }
+
+    void operator()()
+    {
+        state_t& state = *m_state;
+        index_t begin = m_begin;
+        index_t end = m_end;
+
+        while (begin < end && !mp_sb->cancelled())
+        {
+            std::size_t grain = state.grain();
+
+            // Keep at most two chunks' worth and hand the rest to thieves.
+            while (std::size_t(end - begin) > 2 * grain)
+            {
+                index_t middle = begin + (end - begin) / 2;
+                spawn_placed(state.m_where, *mp_sb, range_task(*mp_sb, m_state, middle, end));
+                end = middle;
+            }
+
+            index_t stop = begin + index_t(std::min<std::size_t>(grain, end - begin));
+
+            typename state_t::clock::time_point start = state_t::clock::now();
+            state.m_chunk(begin, stop);
+
+            if (std::size_t(stop - begin) == grain)
+                state.record(grain, state_t::clock::now() - start);
+
+            begin = stop;
+        }
+    }
+
+private:
+    synched_t* mp_sb;
+    std::shared_ptr<state_t> m_state;
+    index_t m_begin;
+    index_t m_end;
+};
+
+// Runs chunk(first, last) over [begin, end) split in adaptively sized
+// pieces, each registered on sb.
+template <typename synched_t, typename index_t, typename chunk_t>
+void parallel_chunks(synched_t& sb, index_t begin, index_t end, chunk_t&& chunk, placement where = placement())
+{
+    typedef range_state<std::decay_t<chunk_t> > state_t;
+
+    if (!(begin < end))
+        return;
+
+    std::shared_ptr<state_t> state = std::make_shared<state_t>(std::forward<chunk_t>(chunk), std::size_t(end - begin),
+            sb.get_executor().concurrency(), where);
+    spawn_placed(where, sb, range_task<synched_t, index_t, std::decay_t<chunk_t> >(sb, state, begin, end));
+}
+
+} // namespace detail
+
+/*
+ * Calls body(i) for every i in [begin, end). The range is split
+ * recursively into tasks registered on sb, and the chunk size adapts to
+ * the measured cost of the body; join with sb.wait_for_all(). The body is
+ * moved once into state shared by all the chunks, which call that one
+ * copy concurrently, through a non-const operator() if it has one.
+ */
+template <typename synched_t, typename index_t, typename body_t, detail::enable_if_synched<synched_t> = 0>
+void parallel_for(synched_t& sb, index_t begin, index_t end, body_t body)
+{
+    parallel_for(placement(), sb, begin, end, std::move(body));
+}
+
+// Same, with every chunk placed: parallel_for(placement::near(data), synch, 0, n, body).
+template <typename synched_t, typename index_t, typename body_t, detail::enable_if_synched<synched_t> = 0>
+void parallel_for(placement where, synched_t& sb, index_t begin, index_t end, body_t body)
+{
+    detail::parallel_chunks(sb, begin, end, [body = std::move(body)](index_t first, index_t last) mutable
+    {
+        for (; first != last; ++first)
+            body(first);
+    }, where);
+}
+
+namespace detail
+{
+
+enum { cache_line_size = 64 };
+
+template <typename T>
+struct alignas(cache_line_size) padded
+{
+    T value;
+};
+
+// Fixed-size array of cache-line aligned elements; operator new does not
+// honour over-alignment before C++17, so the buffer is aligned by hand.
+template <typename T>
+class cache_aligned_array
+{
+public:
+    cache_aligned_array(std::size_t size, const T& value)
+            : m_size(size), mp_buffer(new char[size * sizeof(padded<T>) + cache_line_size])
+    {
+        std::size_t address = reinterpret_cast<std::size_t>(mp_buffer.get());
+        std::size_t aligned = (address + cache_line_size - 1) & ~std::size_t(cache_line_size - 1);
+        mp_items = reinterpret_cast<padded<T>*>(mp_buffer.get() + (aligned - address));
+
+        for (std::size_t i = 0; i < m_size; ++i)
+            new (&mp_items[i].value) T(value);
+    }
+
+    ~cache_aligned_array()
+    {
+        for (std::size_t i = 0; i < m_size; ++i)
+            mp_items[i].value.~T();
+    }
+
+    T& operator[](std::size_t i)
+    {
+        return mp_items[i].value;
+    }
+
+    std::size_t size() const
+    {
+        return m_size;
+    }
+
+private:
+    cache_aligned_array(const cache_aligned_array&);
+    cache_aligned_array& operator=(const cache_aligned_array&);
+
+    std::size_t m_size;
+    std::unique_ptr<char[]> mp_buffer;
+    padded<T>* mp_items;
+};
+
+/*
+ * One partial result per thread, each on its own cache line. A thread
+ * claims a slot the first time it merges and keeps it, so merging never
+ * contends; should more threads show up than there are slots, the rest
+ * share a spin-locked overflow slot.
+ */
+template <typename value_t>
+class reduce_partials
+{
+public:
+    reduce_partials(const value_t& identity, unsigned int workers)
+            : m_slots(2 * std::max(1u, workers) + 1, slot(identity))
+    {
+    }
+
+    template <typename combine_t>
+    void merge(value_t&& value, combine_t& combine)
+    {
+        unsigned int id = thread_id();
+        std::size_t count = m_slots.size() - 1;
+
+        for (std::size_t probe = 0; probe < count; ++probe)
+        {
+            slot& s = m_slots[(id + probe) % count];
+
+            unsigned int owner = s.m_owner;
+
+            if (owner == id || (owner == 0 && s.m_owner.compare_exchange_strong(owner, id)))
+            {
+                s.m_value = combine(std::move(s.m_value), std::move(value));
+                s.m_used = true;
+                return;
+            }
+        }
+
+        slot& overflow = m_slots[count];
+        detail::backoff backoff;
+
+        unsigned int unlocked = 0;
+
+        while (!overflow.m_owner.compare_exchange_weak(unlocked, 1))
+        {
+            unlocked = 0;
+            if (!backoff.pause())
+                std::this_thread::yield();
+        }
+
+        overflow.m_value = combine(std::move(overflow.m_value), std::move(value));
+        overflow.m_used = true;
+        overflow.m_owner = 0;
+    }
+
+    // Pairwise tree over the slots that received a value; call once all
+    // merges are done.
+    template <typename combine_t>
+    value_t combine_all(combine_t& combine)
+    {
+        std::size_t count = 0;
+
+        for (std::size_t i = 0; i < m_slots.size(); ++i)
+            if (m_slots[i].m_used)
+            {
+                if (i != count)
+                    m_slots[count].m_value = std::move(m_slots[i].m_value);
+                ++count;
+            }
+
+        for (std::size_t stride = 1; stride < count; stride *= 2)
+            for (std::size_t i = 0; i + stride < count; i += 2 * stride)
+                m_slots[i].m_value = combine(std::move(m_slots[i].m_value), std::move(m_slots[i + stride].m_value));
+
+        return std::move(m_slots[0].m_value);
+    }
+
+private:
+    struct slot
+    {
+        explicit slot(const value_t& value)
+                : m_owner(0), m_value(value), m_used(false)
+        {
+        }
+
+        slot(const slot& other)
+                : m_owner(0), m_value(other.m_value), m_used(false)
+        {
+        }
+
+        std::atomic<unsigned int> m_owner;
+        value_t m_value;
+        bool m_used;
+    };
+
+    cache_aligned_array<slot> m_slots;
+};
+
+} // namespace detail
+
+/*
+ * Reduces map(i) over [begin, end) with combine, starting from identity,
+ * and returns the result once every chunk has finished. Chunks fold into
+ * per-thread partials which are combined pairwise at the join, so combine
+ * must be associative and commutative and identity neutral for it.
+ */
+template <typename index_t, typename value_t, typename map_t, typename combine_t>
+value_t parallel_reduce(index_t begin, index_t end, value_t identity, map_t map, combine_t combine)
+{
+    executor& exec = default_executor();
+    detail::reduce_partials<value_t> partials(identity, exec.concurrency());
+
+    {
+        synched_t sb(synched_t::join_auto, synched_t::error_cancel, exec);
+
+        detail::parallel_chunks(sb, begin, end, [&](index_t first, index_t last)
+        {
+            value_t value = identity;
+
+            for (; first != last; ++first)
+                value = combine(std::move(value), map(first));
+
+            partials.merge(std::move(value), combine);
+        });
+
+        sb.wait_for_all();
+    }
+
+    return partials.combine_all(combine);
+}
+
+template <typename T>
+class async_value;
+
+namespace detail
+{
+
+// Uninitialised room for a task's result; the void flavour stores nothing.
+template <typename T>
+class result_slot
+{
+public:
+    result_slot()
+            : m_constructed(false)
+    {
+    }
+
+    ~result_slot()
+    {
+        if (m_constructed)
+            get().~T();
+    }
+
+    template <typename function_t>
+    void emplace_from(function_t&& f)
+    {
+        new (&m_storage) T(f());
+        m_constructed = true;
+    }
+
+    T& get()
+    {
+        return *reinterpret_cast<T*>(&m_storage);
+    }
+
+    T take()
+    {
+        return std::move(get());
+    }
+
+private:
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type m_storage;
+    bool m_constructed;
+};
+
+template <>
+class result_slot<void>
+{
+public:
+    template <typename function_t>
+    void emplace_from(function_t&& f)
+    {
+        f();
+    }
+
+    void take()
+    {
+    }
+};
+
+// Something to run when a task's result becomes available.
+struct continuation
+{
+    virtual void fire() = 0;
+
+    continuation* mp_next;
+};
+
+/*
+ * Everything an async_value needs, shared between the handle and the task
+ * that fills it: a join on which get() helps, the list of continuations
+ * waiting for the result, and a reference count. It is the front of the
+ * task object that also holds the callable, so a spawn costs no
+ * allocation beyond the task itself; the task's own reference is the one
+ * dropped by task_base::run.
+ */
+class state_base : public task_base
+{
+public:
+    state_base()
+            : m_join(synched_t::join_help), m_refs(2), m_ready(false), m_continuations(NULL)
+    {
+    }
+
+    void wait()
+    {
+        m_join.wait_for_all();
+    }
+
+    bool ready() const
+    {
+        return m_ready;
+    }
+
+    // Call after wait(); rethrows what the task threw, if anything.
+    void check()
+    {
+        if (m_error)
+            std::rethrow_exception(m_error);
+    }
+
+    void acquire(int count)
+    {
+        m_refs += count;
+    }
+
+    void release()
+    {
+        if (--m_refs == 0)
+            delete this;
+    }
+
+    // Queues c to fire on completion; returns false, without queueing,
+    // when the result is already there.
+    bool attach(continuation& c)
+    {
+        for (;;)
+        {
+            continuation* head = m_continuations;
+
+            if (head == completed())
+                return false;
+
+            c.mp_next = head;
+
+            if (m_continuations.compare_exchange_weak(head, &c))
+                return true;
+        }
+    }
+
+protected:
+    void complete()
+    {
+        continuation* head = m_continuations.exchange(completed());
+
+        while (head)
+        {
+            continuation* next = head->mp_next;
+            head->fire();
+            head = next;
+        }
+    }
+
+    static continuation* completed()
+    {
+        static struct : continuation
+        {
+            void fire()
+            {
+            }
+        } marker;
+
+        return &marker;
+    }
+
+    synched_t m_join;
+    std::atomic<int> m_refs;
+    std::atomic<bool> m_ready;
+    std::atomic<continuation*> m_continuations;
+    std::exception_ptr m_error;
+};
+
+template <typename T>
+class value_state : public state_base
+{
+public:
+    T take()
+    {
+        return m_result.take();
+    }
+
+protected:
+    result_slot<T> m_result;
+};
+
+template <typename T, typename function_t, typename... parameters>
+class value_task : public value_state<T>
+{
+public:
+    template <typename F, typename... P>
+    value_task(F&& f, P&&... p)
+            : m_sw(this->m_join.register_lock()), m_function(std::forward<F>(f)), m_parameters(std::forward<P>(p)...)
+    {
+        static_assert(alignof(value_task) <= alignof(std::max_align_t),
+                "task_pool blocks are only aligned for std::max_align_t; return over-aligned values by pointer");
+    }
+
+protected:
+    void execute()
+    {
+        try
+        {
+            detail::task_scope scope;
+            this->m_result.emplace_from([this]() -> decltype(auto) { return apply_tuple(m_function, m_parameters); });
+        }
+        catch (...)
+        {
+            this->m_error = std::current_exception();
+        }
+
+        {
+            scope_waiter done(std::move(m_sw));
+            this->m_ready = true;
+        }
+
+        this->complete();
+    }
+
+    scope_waiter m_sw;
+    function_t m_function;
+    std::tuple<parameters...> m_parameters;
+};
+
+/*
+ * A value_task that is not spawned until its predecessors complete. It
+ * counts one dependency per predecessor (or a single one when any
+ * predecessor will do) and the last to be satisfied spawns it, so nothing
+ * ever blocks on the dependency. Each link
+ * holds a reference on the block until it has fired, since predecessors
+ * may finish after the task itself is gone.
+ */
+template <bool any, typename T, typename function_t, typename... parameters>
+class deferred_task : public value_task<T, function_t, parameters...>
+{
+public:
+    template <typename F, typename... P>
+    deferred_task(F&& f, P&&... p)
+            : value_task<T, function_t, parameters...>(std::forward<F>(f), std::forward<P>(p)...),
+              mp_links(NULL), m_link_count(0), m_dependencies(0), m_fired(0)
+    {
+    }
+
+    // Last step of construction: the task may run before this returns.
+    void depend_on(state_base* const* states, std::size_t count)
+    {
+        if (count == 0)
+        {
+            default_executor().spawn(*this);
+            return;
+        }
+
+        mp_links = static_cast<link*>(task_pool::allocate(count * sizeof(link)));
+        m_link_count = count;
+
+        for (std::size_t i = 0; i < count; ++i)
+            new (&mp_links[i]) link(*this, i);
+
+        this->acquire(int(count));
+        m_dependencies = any ? 1 : int(count);
+
+        for (std::size_t i = 0; i < count; ++i)
+            if (!states[i]->attach(mp_links[i]))
+                mp_links[i].fire();
+    }
+
+protected:
+    ~deferred_task()
+    {
+        if (mp_links)
+            task_pool::deallocate(mp_links, m_link_count * sizeof(link));
+    }
+
+private:
+    struct link : continuation
+    {
+        link(deferred_task& task, std::size_t index)
+                : mr_task(task), m_index(index)
+        {
+        }
+
+        void fire()
+        {
+            mr_task.satisfy(m_index, std::integral_constant<bool, any>());
+            mr_task.release();
+        }
+
+        deferred_task& mr_task;
+        std::size_t m_index;
+    };
+
+    void satisfy(std::size_t /* index */, std::false_type)
+    {
+        if (--m_dependencies == 0)
+            default_executor().spawn(*this);
+    }
+
+    // when_any: the first link to fire wins and records its position as
+    // the task's leading argument.
+    void satisfy(std::size_t index, std::true_type)
+    {
+        if (m_fired.exchange(1) != 0)
+            return;
+
+        std::get<0>(this->m_parameters) = index;
+        satisfy(index, std::false_type());
+    }
+
+    link* mp_links;
+    std::size_t m_link_count;
+    std::atomic<int> m_dependencies;
+    std::atomic<int> m_fired;
+};
+
+// A moved-from or default constructed async_value has no state to use.
+template <typename state_t>
+state_t* checked_state(state_t* state)
+{
+    if (!state)
+        throw std::logic_error("async_value: no state (default constructed or moved from)");
+
+    return state;
+}
+
+struct state_access
+{
+    template <typename T>
+    static state_base* get(async_value<T>& value)
+    {
+        return checked_state(value.mp_state);
+    }
+};
+
+template <bool any, typename T, typename function_t, typename... parameters>
+async_value<T> make_deferred(state_base* const* states, std::size_t count, function_t&& f, parameters&&... params)
+{
+    typedef deferred_task<any, T, std::decay_t<function_t>, std::decay_t<parameters>...> task_t;
+
+    task_t* t = new task_t(std::forward<function_t>(f), std::forward<parameters>(params)...);
+    async_value<T> result(t);
+    t->depend_on(states, count);
+
+    return result;
+}
+
+} // namespace detail
+
+/*
+ * Handle to the result of a spawned task. get() waits for it, running
+ * other tasks meanwhile, and hands the value out once; dropping a handle
+ * without waiting leaves the task to finish on its own. then() chains a
+ * task that is spawned once this one completes, without blocking anyone.
+ */
+template <typename T>
+class async_value
+{
+public:
+    async_value()
+            : mp_state(NULL)
+    {
+    }
+
+    explicit async_value(detail::value_state<T>* state)
+            : mp_state(state)
+    {
+    }
+
+    async_value(async_value&& other)
+            : mp_state(other.mp_state)
+    {
+        other.mp_state = NULL;
+    }
+
+    async_value& operator=(async_value&& other)
+    {
+        std::swap(mp_state, other.mp_state);
+        return *this;
+    }
+
+    ~async_value()
+    {
+        if (mp_state)
+            mp_state->release();
+    }
+
+    bool valid() const
+    {
+        return mp_state != NULL;
+    }
+
+    // These throw std::logic_error unless valid(), as do then(), and
+    // when_all and when_any when given such a handle.
+    bool ready() const
+    {
+        return detail::checked_state(mp_state)->ready();
+    }
+
+    void wait()
+    {
+        detail::checked_state(mp_state)->wait();
+    }
+
+    // Rethrows the task's exception, if it threw one.
+    T get()
+    {
+        detail::checked_state(mp_state);
+        async_value done(std::move(*this));
+
+        done.mp_state->wait();
+        done.mp_state->check();
+        return done.mp_state->take();
+    }
+
+    // Consumes this handle; f receives it, ready, once the value is there.
+    template <typename function_t>
+    async_value<std::decay_t<decltype(std::declval<std::decay_t<function_t>&>()(std::declval<async_value&&>()))> >
+    then(function_t&& f)
+    {
+        typedef std::decay_t<decltype(std::declval<std::decay_t<function_t>&>()(std::declval<async_value&&>()))> result_t;
+
+        detail::state_base* state = detail::checked_state(mp_state);
+        return detail::make_deferred<false, result_t>(&state, 1, std::forward<function_t>(f), std::move(*this));
+    }
+
+private:
+    friend struct detail::state_access;
+
+    async_value(const async_value&);
+    async_value& operator=(const async_value&);
+
+    detail::value_state<T>* mp_state;
+};
+
+template <typename function_t, typename... parameters>
+using spawn_result_t = std::decay_t<decltype(detail::apply_tuple(std::declval<std::decay_t<function_t>&>(),
+        std::declval<std::tuple<std::decay_t<parameters>...>&>()))>;
+
+// Runs f(params...) as a task and returns a handle to its result.
+template <typename function_t, typename... parameters>
+async_value<spawn_result_t<function_t, parameters...> > spawn(function_t&& f, parameters&&... params)
+{
+    typedef spawn_result_t<function_t, parameters...> result_t;
+    typedef detail::value_task<result_t, std::decay_t<function_t>, std::decay_t<parameters>...> task_t;
+
+    task_t* t = new task_t(std::forward<function_t>(f), std::forward<parameters>(params)...);
+    default_executor().spawn(*t);
+
+    return async_value<result_t>(t);
+}
+
+// Ready once every input is; hands all of them back, ready.
+template <typename... T>
+async_value<std::tuple<async_value<T>...> > when_all(async_value<T>&&... values)
+{
+    typedef std::tuple<async_value<T>...> result_t;
+
+    detail::state_base* states[] = { detail::state_access::get(values)..., NULL };
+
+    return detail::make_deferred<false, result_t>(states, sizeof...(T),
+            [](async_value<T>&&... ready) { return result_t(std::move(ready)...); },
+            std::move(values)...);
+}
+
+template <typename T>
+async_value<std::vector<async_value<T> > > when_all(std::vector<async_value<T> > values)
+{
+    typedef std::vector<async_value<T> > result_t;
+
+    std::vector<detail::state_base*> states;
+    for (std::size_t i = 0; i < values.size(); ++i)
+        states.push_back(detail::state_access::get(values[i]));
+
+    return detail::make_deferred<false, result_t>(states.data(), states.size(),
+            [](result_t&& ready) { return std::move(ready); },
+            std::move(values));
+}
+
+template <typename sequence_t>
+struct when_any_result
+{
+    // Position of the input that completed first; npos for no inputs.
+    std::size_t index;
+    sequence_t values;
+
+    enum : std::size_t { npos = std::size_t(-1) };
+};
+
+// Ready as soon as one input is; the others are handed back as they are.
+template <typename... T>
+async_value<when_any_result<std::tuple<async_value<T>...> > > when_any(async_value<T>&&... values)
+{
+    typedef when_any_result<std::tuple<async_value<T>...> > result_t;
+
+    detail::state_base* states[] = { detail::state_access::get(values)..., NULL };
+
+    return detail::make_deferred<true, result_t>(states, sizeof...(T),
+            [](std::size_t index, async_value<T>&&... inputs) { return result_t { index, std::tuple<async_value<T>...>(std::move(inputs)...) }; },
+            std::size_t(result_t::npos), std::move(values)...);
+}
+
+template <typename T>
+async_value<when_any_result<std::vector<async_value<T> > > > when_any(std::vector<async_value<T> > values)
+{
+    typedef when_any_result<std::vector<async_value<T> > > result_t;
+
+    std::vector<detail::state_base*> states;
+    for (std::size_t i = 0; i < values.size(); ++i)
+        states.push_back(detail::state_access::get(values[i]));
+
+    return detail::make_deferred<true, result_t>(states.data(), states.size(),
+            [](std::size_t index, std::vector<async_value<T> >&& inputs) { return result_t { index, std::move(inputs) }; },
+            std::size_t(result_t::npos), std::move(values));
+}
+
 } // namespace cpp_utils
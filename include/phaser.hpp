@@ -0,0 +1,374 @@
+/*    This file is part of cpp-utils
+ *    Copyright (c) 2010 Victor Vicente de Carvalho <victor.v.carvalho@gmail.com>
+ *
+ *    cpp-utils is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    cpp-utils is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with corvogame.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *    Latch, barrier and phaser: phase synchronisation for tasks that live
+ *    across iterations, the x10 clock to go with finish (synched_t) and
+ *    async (parallel).
+ *    usage:
+ *
+ *   //ONE-SHOT, n count_down ()s release every wait ():
+ *   cpp_utils::latch ready ( n );
+ *
+ *   //N PARTIES, phase after phase:
+ *   cpp_utils::barrier step ( n, swap_buffers );
+ *   for ( ;; ) { compute ( ); step.arrive_and_wait ( ); }
+ *
+ *   //X10 CLOCK, parties may register and drop at any phase:
+ *   cpp_utils::phaser clock ( 1 );
+ *   clock.register_party ( );  //before handing the clock to a new task
+ *   clock.advance ( );         //x10 next
+ *   clock.drop ( );            //when the task leaves the clock
+ *
+ *   A waiter blocks its thread, so every party has to be running at the
+ *   same time: keep the parties at or below the executor's concurrency.
+ */
+
+#pragma once
+
+#include "executor.hpp"
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+
+namespace cpp_utils
+{
+
+namespace detail
+{
+
+/*
+ * A phase number that threads wait on to change. Waiters spin with
+ * backoff and then sleep on the word itself after setting its top bit, so
+ * publishing a new phase is one compare-and-swap, plus a futex wake only
+ * if somebody went to sleep. The swap is the publisher's last access: the
+ * wake only needs the address, as in synched_t::release.
+ *
+ * Phases only move forward (modulo 2^31): a publisher that finds the word
+ * already at or past its phase leaves it alone, so late publishers cannot
+ * take the phase back.
+ */
+class phase_word
+{
+public:
+    enum
+    {
+        sleepers_flag = INT_MIN,
+        value_mask = INT_MAX
+    };
+
+    explicit phase_word(int value = 0)
+            : m_word(value)
+    {
+    }
+
+    int load() const
+    {
+        return m_word.load(std::memory_order_acquire) & value_mask;
+    }
+
+    void advance_to(int value)
+    {
+        value &= value_mask;
+        int current = m_word.load(std::memory_order_relaxed);
+
+        for (;;)
+        {
+            int ahead = (value - (current & value_mask)) & value_mask;
+
+            if (ahead == 0 || ahead > value_mask / 2)
+                return;
+
+            if (m_word.compare_exchange_weak(current, value))
+                break;
+        }
+
+        if (current & sleepers_flag)
+            futex_wake(m_word, INT_MAX);
+    }
+
+    void wait_while(int value)
+    {
+        value &= value_mask;
+        backoff backoff;
+
+        for (;;)
+        {
+            int current = m_word.load(std::memory_order_acquire);
+
+            if ((current & value_mask) != value)
+                return;
+
+            if (backoff.pause())
+                continue;
+
+            if (!(current & sleepers_flag)
+                    && !m_word.compare_exchange_weak(current, current | sleepers_flag))
+                continue;
+
+            futex_wait(m_word, value | sleepers_flag);
+        }
+    }
+
+private:
+    std::atomic<int> m_word;
+};
+
+} // namespace detail
+
+/*
+ * Single-use countdown: wait() returns once count_down() has been called
+ * count times in total.
+ */
+class latch
+{
+public:
+    explicit latch(int count)
+            : m_count(count), m_released(count <= 0 ? 1 : 0)
+    {
+    }
+
+    void count_down(int n = 1)
+    {
+        if (m_count.fetch_sub(n, std::memory_order_acq_rel) == n)
+            m_released.advance_to(1);
+    }
+
+    bool try_wait() const
+    {
+        return m_released.load() != 0;
+    }
+
+    void wait()
+    {
+        m_released.wait_while(0);
+    }
+
+    void arrive_and_wait(int n = 1)
+    {
+        count_down(n);
+        wait();
+    }
+
+private:
+    latch(const latch&);
+    latch& operator=(const latch&);
+
+    std::atomic<int> m_count;
+    char m_count_pad[64];
+    detail::phase_word m_released;
+};
+
+/*
+ * Reusable barrier for a fixed set of parties. Sense reversal is done with
+ * a phase number instead of a flag: arrivals count down m_remaining, and
+ * the last one re-arms it for the next phase before publishing that phase,
+ * which is what everybody else waits on. The arrival counter and the phase
+ * sit on separate cache lines, so spinning waiters do not slow down the
+ * arrivals. The optional completion runs on the last arriving thread, after
+ * every party has arrived and before any is released.
+ */
+class barrier
+{
+public:
+    explicit barrier(int parties, std::function<void()> on_completion = std::function<void()>())
+            : m_remaining(parties), m_parties(parties), m_on_completion(std::move(on_completion))
+    {
+    }
+
+    void arrive_and_wait()
+    {
+        int phase = m_phase.load();
+
+        if (arrive(false))
+            m_phase.wait_while(phase);
+    }
+
+    // Arrives and leaves the barrier for good; later phases expect one
+    // party fewer.
+    void arrive_and_drop()
+    {
+        arrive(true);
+    }
+
+private:
+    barrier(const barrier&);
+    barrier& operator=(const barrier&);
+
+    // Returns true when the caller has to wait for the others.
+    bool arrive(bool drop)
+    {
+        if (drop)
+            m_parties.fetch_sub(1, std::memory_order_relaxed);
+
+        if (m_remaining.fetch_sub(1, std::memory_order_acq_rel) != 1)
+            return true;
+
+        if (m_on_completion)
+            m_on_completion();
+
+        m_remaining.store(m_parties.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        m_phase.advance_to(m_phase.load() + 1);
+        return false;
+    }
+
+    std::atomic<int> m_remaining;
+    std::atomic<int> m_parties;
+    char m_remaining_pad[64];
+    detail::phase_word m_phase;
+    char m_phase_pad[64];
+    std::function<void()> m_on_completion;
+};
+
+/*
+ * X10 clock (java.util.concurrent.Phaser without tiering). Parties can
+ * register and drop at any time; a phase ends when every party registered
+ * in it has arrived. arrive() does not block, so a party can announce it
+ * is done with a phase, do unrelated work and only then wait() for the
+ * others (x10 resume followed by next).
+ *
+ * Phase, parties and unarrived parties share one 64-bit word, so
+ * registration and arrival never disagree about which phase they belong
+ * to; phase_word mirrors the phase for the waiters. At most 65535 parties.
+ * Phase numbers wrap at 2^31.
+ */
+class phaser
+{
+public:
+    explicit phaser(unsigned int parties = 0)
+            : m_state(pack(0, check_parties(parties), parties))
+    {
+    }
+
+    // Adds a party to the current phase and returns that phase.
+    unsigned int register_party()
+    {
+        std::uint64_t state = m_state.load(std::memory_order_acquire);
+
+        for (;;)
+        {
+            unsigned int parties = check_parties(parties_of(state) + 1);
+            std::uint64_t next = pack(phase_of(state), parties, unarrived_of(state) + 1);
+
+            if (m_state.compare_exchange_weak(state, next, std::memory_order_acq_rel))
+                return phase_of(state);
+        }
+    }
+
+    // Arrives without waiting; returns the phase arrived at.
+    unsigned int arrive()
+    {
+        return arrive(false);
+    }
+
+    // Arrives and deregisters; returns the phase arrived at.
+    unsigned int drop()
+    {
+        return arrive(true);
+    }
+
+    // Blocks until the given phase is over; returns the current phase.
+    unsigned int wait(unsigned int phase)
+    {
+        m_phase.wait_while(int(phase));
+        return phase_of(m_state.load(std::memory_order_acquire));
+    }
+
+    // x10 next: arrives and waits for everybody else; returns the new phase.
+    unsigned int advance()
+    {
+        return wait(arrive(false));
+    }
+
+    unsigned int phase() const
+    {
+        return phase_of(m_state.load(std::memory_order_acquire));
+    }
+
+    unsigned int parties() const
+    {
+        return parties_of(m_state.load(std::memory_order_acquire));
+    }
+
+private:
+    phaser(const phaser&);
+    phaser& operator=(const phaser&);
+
+    enum { max_parties = 0xffff };
+
+    static std::uint64_t pack(unsigned int phase, unsigned int parties, unsigned int unarrived)
+    {
+        return (std::uint64_t(phase & detail::phase_word::value_mask) << 32)
+                | (std::uint64_t(parties) << 16) | unarrived;
+    }
+
+    static unsigned int phase_of(std::uint64_t state)
+    {
+        return unsigned(state >> 32);
+    }
+
+    static unsigned int parties_of(std::uint64_t state)
+    {
+        return unsigned(state >> 16) & max_parties;
+    }
+
+    static unsigned int unarrived_of(std::uint64_t state)
+    {
+        return unsigned(state) & max_parties;
+    }
+
+    static unsigned int check_parties(unsigned int parties)
+    {
+        if (parties > max_parties)
+            throw std::length_error("phaser: too many parties");
+        return parties;
+    }
+
+    unsigned int arrive(bool drop)
+    {
+        std::uint64_t state = m_state.load(std::memory_order_acquire);
+
+        for (;;)
+        {
+            unsigned int phase = phase_of(state);
+            unsigned int parties = parties_of(state) - (drop ? 1 : 0);
+            unsigned int unarrived = unarrived_of(state);
+
+            if (unarrived == 0)
+                throw std::logic_error("phaser: arrival from an unregistered party");
+
+            // The last arrival opens the next phase for whoever is left.
+            bool last = unarrived == 1;
+            std::uint64_t next = last ? pack(phase + 1, parties, parties) : pack(phase, parties, unarrived - 1);
+
+            if (m_state.compare_exchange_weak(state, next, std::memory_order_acq_rel))
+            {
+                if (last)
+                    m_phase.advance_to(int(phase + 1));
+                return phase;
+            }
+        }
+    }
+
+    std::atomic<std::uint64_t> m_state;
+    char m_state_pad[64];
+    detail::phase_word m_phase;
+};
+
+} // namespace cpp_utils
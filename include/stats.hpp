@@ -0,0 +1,301 @@
+/*    This file is part of cpp-utils
+ *    Copyright (c) 2010 Victor Vicente de Carvalho <victor.v.carvalho@gmail.com>
+ *
+ *    cpp-utils is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    cpp-utils is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with corvogame.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *    Per-group latency histograms
+ *    usage:
+ *
+ *   cpp_utils::task_stats decode ( "decode" );  //one per kind of work
+ *   cpp_utils::synched_t synch;
+ *   synch.set_stats ( &decode );                 //before spawning into synch
+ *   cpp_utils::parallel ( synch, decode_frame, frame );
+ *
+ *   cpp_utils::stats_snapshot s = decode.snapshot ( );
+ *   s.m_queue.p99 ( );   //ns from spawn to start
+ *   s.m_run.p99 ( );     //ns from start to finish
+ *
+ *   A high queue tail with a flat run time means the pool is saturated; a
+ *   run tail means the bodies themselves are slow. Several groups may share
+ *   one task_stats. Groups without one pay nothing but a null check.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "ticks.hpp"
+
+namespace cpp_utils
+{
+
+namespace detail
+{
+
+/*
+ * HDR-style log-linear buckets: exact below sub_bucket_count, then
+ * sub_bucket_count buckets per power of two, so any value is known to
+ * within 1 / sub_bucket_count of itself. Values are clock ticks, clamped
+ * to 2^48.
+ */
+struct histogram_layout
+{
+    enum
+    {
+        sub_bucket_bits = 4,
+        sub_bucket_count = 1 << sub_bucket_bits,
+        max_magnitude = 47,
+        bucket_count = sub_bucket_count * (max_magnitude - sub_bucket_bits + 2)
+    };
+
+    static std::size_t index(std::uint64_t value)
+    {
+        if (value < std::uint64_t(sub_bucket_count))
+            return std::size_t(value);
+
+        int magnitude = 63 - __builtin_clzll(value);
+
+        if (magnitude > max_magnitude)
+            return bucket_count - 1;
+
+        int shift = magnitude - sub_bucket_bits;
+        return std::size_t(sub_bucket_count * (shift + 1) + int(value >> shift) - sub_bucket_count);
+    }
+
+    // Midpoint of the values that land in bucket i.
+    static double value(std::size_t i)
+    {
+        if (i < std::size_t(sub_bucket_count))
+            return double(i);
+
+        int shift = int(i / sub_bucket_count) - 1;
+        std::uint64_t low = std::uint64_t(i % sub_bucket_count + sub_bucket_count) << shift;
+        return double(low) + double((std::uint64_t(1) << shift) - 1) / 2;
+    }
+};
+
+// Calling thread's shard number; threads beyond shard_count share.
+inline unsigned int stats_slot()
+{
+    static std::atomic<unsigned int> next(0);
+    static thread_local unsigned int slot = next++;
+    return slot;
+}
+
+} // namespace detail
+
+/*
+ * Read side of a histogram: bucket counts added up over the shards and
+ * converted to nanoseconds.
+ */
+class latency_histogram
+{
+public:
+    latency_histogram()
+            : m_counts(detail::histogram_layout::bucket_count, 0), m_total(0), m_ns_per_tick(1.0)
+    {
+    }
+
+    std::uint64_t count() const
+    {
+        return m_total;
+    }
+
+    // Nanoseconds under which a fraction q of the samples fall; 0 when
+    // there are none.
+    double percentile(double q) const
+    {
+        if (m_total == 0)
+            return 0;
+
+        std::uint64_t rank = std::max<std::uint64_t>(1, std::uint64_t(std::ceil(q * double(m_total))));
+        std::uint64_t seen = 0;
+
+        for (std::size_t i = 0; i < m_counts.size(); ++i)
+        {
+            seen += m_counts[i];
+
+            if (seen >= rank)
+                return detail::histogram_layout::value(i) * m_ns_per_tick;
+        }
+
+        return max();
+    }
+
+    double p50() const
+    {
+        return percentile(0.5);
+    }
+
+    double p99() const
+    {
+        return percentile(0.99);
+    }
+
+    double p999() const
+    {
+        return percentile(0.999);
+    }
+
+    double max() const
+    {
+        for (std::size_t i = m_counts.size(); i-- > 0;)
+            if (m_counts[i])
+                return detail::histogram_layout::value(i) * m_ns_per_tick;
+
+        return 0;
+    }
+
+private:
+    friend class task_stats;
+
+    std::vector<std::uint64_t> m_counts;
+    std::uint64_t m_total;
+    double m_ns_per_tick;
+};
+
+struct stats_snapshot
+{
+    std::string m_name;
+    latency_histogram m_queue;
+    latency_histogram m_run;
+};
+
+/*
+ * Queue time (spawn to start) and run time (start to finish) of the tasks
+ * of every group it is attached to. Threads record into shard_count
+ * shards, picked by thread number and allocated on their first sample,
+ * with relaxed increments: nothing locks, and threads only share a shard
+ * (and its cache lines) once there are more than shard_count of them.
+ * snapshot() adds the shards up while they are written to, so a sample
+ * may show in one histogram and not yet in the other. Cancelled tasks that
+ * never ran are not counted.
+ *
+ * Must outlive the groups using it and the tasks spawned into them.
+ */
+class task_stats
+{
+public:
+    explicit task_stats(const std::string& name = std::string())
+            : m_name(name)
+    {
+        for (std::size_t i = 0; i < shard_count; ++i)
+            m_shards[i] = NULL;
+
+        // Starts measuring the tick rate, so that snapshots need not wait.
+        detail::tick_clock::instance();
+    }
+
+    ~task_stats()
+    {
+        for (std::size_t i = 0; i < shard_count; ++i)
+            delete m_shards[i].load(std::memory_order_relaxed);
+    }
+
+    const std::string& name() const
+    {
+        return m_name;
+    }
+
+    // Called by the tasks, with times in ticks (see ticks.hpp).
+    void record(std::uint64_t queued, std::uint64_t ran)
+    {
+        shard& local = local_shard();
+
+        local.m_queue[detail::histogram_layout::index(queued)].fetch_add(1, std::memory_order_relaxed);
+        local.m_run[detail::histogram_layout::index(ran)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    stats_snapshot snapshot() const
+    {
+        stats_snapshot result;
+        result.m_name = m_name;
+
+        double ns_per_tick = detail::tick_clock::instance().ns_per_tick();
+        result.m_queue.m_ns_per_tick = ns_per_tick;
+        result.m_run.m_ns_per_tick = ns_per_tick;
+
+        for (std::size_t i = 0; i < shard_count; ++i)
+        {
+            const shard* s = m_shards[i].load(std::memory_order_acquire);
+
+            if (!s)
+                continue;
+
+            for (std::size_t b = 0; b < detail::histogram_layout::bucket_count; ++b)
+            {
+                std::uint64_t queued = s->m_queue[b].load(std::memory_order_relaxed);
+                std::uint64_t ran = s->m_run[b].load(std::memory_order_relaxed);
+
+                result.m_queue.m_counts[b] += queued;
+                result.m_queue.m_total += queued;
+                result.m_run.m_counts[b] += ran;
+                result.m_run.m_total += ran;
+            }
+        }
+
+        return result;
+    }
+
+private:
+    task_stats(const task_stats&);
+    task_stats& operator=(const task_stats&);
+
+    enum { shard_count = 64 };
+
+    struct shard
+    {
+        shard()
+        {
+            for (std::size_t b = 0; b < detail::histogram_layout::bucket_count; ++b)
+            {
+                m_queue[b] = 0;
+                m_run[b] = 0;
+            }
+        }
+
+        std::atomic<std::uint64_t> m_queue[detail::histogram_layout::bucket_count];
+        std::atomic<std::uint64_t> m_run[detail::histogram_layout::bucket_count];
+    };
+
+    shard& local_shard()
+    {
+        std::atomic<shard*>& slot = m_shards[detail::stats_slot() % shard_count];
+        shard* s = slot.load(std::memory_order_acquire);
+
+        if (s)
+            return *s;
+
+        // Only contended past shard_count threads; the loser frees its copy.
+        shard* fresh = new shard;
+
+        if (slot.compare_exchange_strong(s, fresh, std::memory_order_acq_rel, std::memory_order_acquire))
+            return *fresh;
+
+        delete fresh;
+        return *s;
+    }
+
+    std::string m_name;
+    std::atomic<shard*> m_shards[shard_count];
+};
+
+} // namespace cpp_utils
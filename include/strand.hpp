@@ -0,0 +1,229 @@
+/*    This file is part of cpp-utils
+ *    Copyright (c) 2010 Victor Vicente de Carvalho <victor.v.carvalho@gmail.com>
+ *
+ *    cpp-utils is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    cpp-utils is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with corvogame.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *    Strand: serial execution on the shared pool, in place of a per-object
+ *    mutex
+ *    usage:
+ *
+ *   class session
+ *   {
+ *       cpp_utils::strand m_strand;   //one per object, no thread behind it
+ *       ...
+ *   };
+ *
+ *   //same arguments as parallel; runs one at a time, in posting order:
+ *   m_strand.post ( handle_message, msg );
+ *   m_strand.post ( synch, flush, buffer );   //joined and cancelled with synch
+ *
+ *   Posting never blocks, and no worker ever waits for a strand: whoever
+ *   finds it idle schedules a single task that runs what has been posted.
+ */
+
+#pragma once
+
+#include "parallell.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+namespace cpp_utils
+{
+
+/*
+ * Posted tasks go on a lock-free stack (one compare-and-swap per post) that
+ * the drain task takes over whole with one exchange and reverses, so they
+ * run in posting order. The stack head also tells whether a drain is
+ * scheduled: idle_marker() means nobody is draining, and the post that
+ * replaces it spawns the drain task. The drain goes back to idle only by
+ * swapping an empty stack for the marker, so a post either lands before
+ * that swap and is run, or finds the marker and schedules a new drain.
+ *
+ * After drain_budget tasks the drain respawns itself instead of looping,
+ * so a busy strand shares its worker with everything else on the pool.
+ *
+ * Tasks posted with a group behave as with parallel(sb, ...): they count
+ * in its join, skip when it is cancelled, and hand it their exceptions.
+ * Without a group an exception goes to the handler set with
+ * set_unhandled_exception_handler, as with parallel, and the drain goes
+ * on with the next task.
+ *
+ * The destructor waits for the tasks already posted (helping or sleeping
+ * like a synched_t join); do not destroy a strand from one of its own
+ * tasks.
+ */
+class strand
+{
+public:
+    explicit strand(executor& exec = default_executor())
+            : mr_executor(exec), m_head(idle_marker()), mp_ready(NULL)
+    {
+    }
+
+    ~strand()
+    {
+        if (m_head.load(std::memory_order_acquire) == idle_marker())
+            return;
+
+        // Runs after everything posted before it.
+        {
+            synched_t done(synched_t::join_auto, synched_t::error_continue, mr_executor);
+            post(done, [] { });
+            done.wait_for_all();
+        }
+
+        // The drain may still be on its way out; going idle is the last
+        // thing it does with the strand.
+        detail::backoff backoff;
+
+        while (m_head.load(std::memory_order_acquire) != idle_marker())
+            if (!backoff.pause())
+                std::this_thread::yield();
+    }
+
+    template <typename synched_t, typename function_t, detail::enable_if_synched<synched_t> = 0>
+    void post(synched_t& sb, function_t&& func)
+    {
+        push(*new contended_caller<std::decay_t<function_t> >(sb, std::forward<function_t>(func)));
+    }
+
+    template <typename function_t>
+    void post(function_t&& func)
+    {
+        push(*new simple_caller<std::decay_t<function_t> >(std::forward<function_t>(func)));
+    }
+
+    template <typename synched_t, typename function_t, typename... parameters, detail::enable_if_synched<synched_t> = 0>
+    void post(synched_t& sb, function_t&& f, parameters&&... params)
+    {
+        post(sb, detail::bind_call(std::forward<function_t>(f), std::forward<parameters>(params)...));
+    }
+
+    template <typename function_t, typename... parameters>
+    void post(function_t&& f, parameters&&... params)
+    {
+        post(detail::bind_call(std::forward<function_t>(f), std::forward<parameters>(params)...));
+    }
+
+    executor& get_executor()
+    {
+        return mr_executor;
+    }
+
+private:
+    strand(const strand&);
+    strand& operator=(const strand&);
+
+    enum { drain_budget = 64 };
+
+    // Allocated per scheduling, so that nothing of the strand is touched
+    // once it has gone idle.
+    class drain_task : public task_base
+    {
+    public:
+        explicit drain_task(strand& owner)
+                : mr_owner(owner)
+        {
+        }
+
+        void execute()
+        {
+            mr_owner.drain();
+        }
+
+    private:
+        strand& mr_owner;
+    };
+
+    // Tasks are at least pointer aligned, so this is never one of them.
+    static task_base* idle_marker()
+    {
+        return reinterpret_cast<task_base*>(std::uintptr_t(1));
+    }
+
+    void push(task_base& task)
+    {
+        task_base* head = m_head.load(std::memory_order_relaxed);
+
+        do
+            task.mp_next = head == idle_marker() ? NULL : head;
+        while (!m_head.compare_exchange_weak(head, &task, std::memory_order_acq_rel, std::memory_order_relaxed));
+
+        if (head == idle_marker())
+            mr_executor.spawn(*new drain_task(*this));
+    }
+
+    void drain()
+    {
+        for (int budget = drain_budget;; --budget)
+        {
+            if (!mp_ready && !take_posted())
+                return;
+
+            if (budget == 0)
+            {
+                mr_executor.spawn(*new drain_task(*this));
+                return;
+            }
+
+            task_base* task = mp_ready;
+            mp_ready = task->mp_next;
+            task->run();
+        }
+    }
+
+    // Moves the posted tasks to mp_ready in posting order; false once the
+    // strand has gone idle.
+    bool take_posted()
+    {
+        for (;;)
+        {
+            task_base* posted = m_head.exchange(NULL, std::memory_order_acquire);
+
+            if (!posted)
+            {
+                task_base* empty = NULL;
+
+                if (m_head.compare_exchange_strong(empty, idle_marker(), std::memory_order_release, std::memory_order_relaxed))
+                    return false;
+
+                continue;
+            }
+
+            while (posted)
+            {
+                task_base* next = posted->mp_next;
+                posted->mp_next = mp_ready;
+                mp_ready = posted;
+                posted = next;
+            }
+
+            return true;
+        }
+    }
+
+    executor& mr_executor;
+    std::atomic<task_base*> m_head;
+    char m_head_pad[64];
+
+    // Only touched by the drain task, which runs one at a time.
+    task_base* mp_ready;
+};
+
+} // namespace cpp_utils
@@ -0,0 +1,249 @@
+/*    This file is part of cpp-utils
+ *    Copyright (c) 2010 Victor Vicente de Carvalho <victor.v.carvalho@gmail.com>
+ * 
+ *    cpp-utils is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    cpp-utils is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with corvogame.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * 
+ *    Task graph: a static DAG of callables, built once and run many times
+ *    usage:
+ *
+ *    cpp_utils::task_graph graph;
+ *    cpp_utils::task_graph::node_id load = graph.add ( load_function, path );
+ *    cpp_utils::task_graph::node_id parse = graph.add ( parse_function );
+ *    graph.add_edge ( load, parse );
+ *
+ *    graph.run ();  graph.wait_for_all ();   //as often as needed
+ */
+
+#pragma once
+
+#include "parallell.hpp"
+
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+
+namespace cpp_utils
+{
+
+namespace detail
+{
+
+// Unlike apply_tuple this leaves the arguments in place, since a graph
+// node runs once per graph run.
+template <typename function_t, typename tuple_t, std::size_t... I>
+void call_with(function_t& f, tuple_t& t, std::index_sequence<I...>)
+{
+    f(std::get<I>(t)...);
+}
+
+struct graph_body
+{
+    virtual ~graph_body()
+    {
+    }
+
+    virtual void invoke() = 0;
+};
+
+template <typename function_t, typename... parameters>
+class graph_callable : public graph_body
+{
+public:
+    template <typename F, typename... P>
+    graph_callable(F&& f, P&&... p)
+            : m_function(std::forward<F>(f)), m_parameters(std::forward<P>(p)...)
+    {
+    }
+
+    void invoke()
+    {
+        call_with(m_function, m_parameters, std::index_sequence_for<parameters...>());
+    }
+
+private:
+    function_t m_function;
+    std::tuple<parameters...> m_parameters;
+};
+
+} // namespace detail
+
+/*
+ * Nodes take the same callables and arguments as parallel and edges are
+ * declared up front. Each run resets every node's atomic predecessor
+ * counter and spawns the nodes without predecessors; a finishing node
+ * spawns each successor whose counter it takes to zero. All storage is
+ * set up while building, so running the graph again allocates nothing
+ * beyond the tasks themselves. Runs must not overlap. A node that throws
+ * holds back its successors and wait_for_all rethrows the exception.
+ */
+class task_graph
+{
+public:
+    typedef std::size_t node_id;
+
+    explicit task_graph(synched_t::join_mode mode = synched_t::join_auto)
+            : m_synch(mode), m_validated(true)
+    {
+    }
+
+    // Joins a run still in flight; as with synched_t, an exception nobody
+    // waited for is dropped.
+    ~task_graph()
+    {
+        try
+        {
+            m_synch.wait_for_all();
+        }
+        catch (...)
+        {
+        }
+    }
+
+    template <typename function_t, typename... parameters>
+    node_id add(function_t&& f, parameters&&... params)
+    {
+        typedef detail::graph_callable<std::decay_t<function_t>, std::decay_t<parameters>...> callable_t;
+
+        std::unique_ptr<node> n(new node(m_nodes.size(), new callable_t(std::forward<function_t>(f), std::forward<parameters>(params)...)));
+        m_nodes.push_back(std::move(n));
+        m_validated = false;
+
+        return m_nodes.size() - 1;
+    }
+
+    // from runs to completion before to starts.
+    void add_edge(node_id from, node_id to)
+    {
+        m_nodes.at(from)->m_successors.push_back(m_nodes.at(to).get());
+        ++m_nodes[to]->m_predecessors;
+        m_validated = false;
+    }
+
+    std::size_t size() const
+    {
+        return m_nodes.size();
+    }
+
+    // Starts a run; throws std::logic_error if the edges form a cycle.
+    void run()
+    {
+        if (!m_validated)
+            validate();
+
+        for (std::size_t i = 0; i < m_nodes.size(); ++i)
+            m_nodes[i]->m_pending = m_nodes[i]->m_predecessors;
+
+        for (std::size_t i = 0; i < m_roots.size(); ++i)
+            parallel(m_synch, node_runner(*this, *m_roots[i]));
+    }
+
+    void wait_for_all()
+    {
+        m_synch.wait_for_all();
+    }
+
+    void run_and_wait()
+    {
+        run();
+        wait_for_all();
+    }
+
+private:
+    task_graph(const task_graph&);
+    task_graph& operator=(const task_graph&);
+
+    struct node
+    {
+        node(node_id id, detail::graph_body* body)
+                : m_id(id), mp_body(body), m_predecessors(0)
+        {
+            m_pending = 0;
+        }
+
+        node_id m_id;
+        std::unique_ptr<detail::graph_body> mp_body;
+        std::vector<node*> m_successors;
+        unsigned int m_predecessors;
+        std::atomic<unsigned int> m_pending;
+    };
+
+    struct node_runner
+    {
+        node_runner(task_graph& graph, node& n)
+                : mp_graph(&graph), mp_node(&n)
+        {
+        }
+
+        void operator()()
+        {
+            mp_node->mp_body->invoke();
+
+            std::vector<node*>& successors = mp_node->m_successors;
+
+            for (std::size_t i = 0; i < successors.size(); ++i)
+                if (--successors[i]->m_pending == 0)
+                    parallel(mp_graph->m_synch, node_runner(*mp_graph, *successors[i]));
+        }
+
+        task_graph* mp_graph;
+        node* mp_node;
+    };
+
+    // Collects the roots and checks, Kahn style, that every node can be
+    // reached once its predecessors are done.
+    void validate()
+    {
+        std::vector<unsigned int> pending(m_nodes.size());
+        std::vector<node*> ready;
+
+        m_roots.clear();
+
+        for (std::size_t i = 0; i < m_nodes.size(); ++i)
+        {
+            pending[i] = m_nodes[i]->m_predecessors;
+
+            if (pending[i] == 0)
+                m_roots.push_back(m_nodes[i].get());
+        }
+
+        ready = m_roots;
+        std::size_t visited = 0;
+
+        while (!ready.empty())
+        {
+            node* n = ready.back();
+            ready.pop_back();
+            ++visited;
+
+            for (std::size_t i = 0; i < n->m_successors.size(); ++i)
+                if (--pending[n->m_successors[i]->m_id] == 0)
+                    ready.push_back(n->m_successors[i]);
+        }
+
+        if (visited != m_nodes.size())
+            throw std::logic_error("task_graph: edges form a cycle");
+
+        m_validated = true;
+    }
+
+    synched_t m_synch;
+    std::vector<std::unique_ptr<node> > m_nodes;
+    std::vector<node*> m_roots;
+    bool m_validated;
+};
+
+} // namespace cpp_utils
@@ -0,0 +1,130 @@
+/*    This file is part of cpp-utils
+ *    Copyright (c) 2010 Victor Vicente de Carvalho <victor.v.carvalho@gmail.com>
+ *
+ *    cpp-utils is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    cpp-utils is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with corvogame.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *    Executor on the legacy tbb::task scheduler
+ *
+ *    What parallell.hpp used to be hard-wired to. Needs a TBB that still
+ *    ships tbb/task.h (2020 or older); selected as the default executor by
+ *    defining CPP_UTILS_USE_TBB.
+ */
+
+#pragma once
+
+#include "executor.hpp"
+
+#include <tbb/task.h>
+#include <tbb/task_scheduler_init.h>
+
+namespace cpp_utils
+{
+
+class tbb_executor : public executor
+{
+public:
+    void spawn(task_base& task)
+    {
+        tbb::task::spawn(*new (tbb::task::allocate_root()) carrier(task));
+    }
+
+    void spawn(task_list& tasks)
+    {
+        tbb::task_list list;
+
+        while (task_base* task = tasks.pop_front())
+            list.push_back(*new (tbb::task::allocate_root()) carrier(*task));
+
+        tbb::task::spawn(list);
+    }
+
+    // Legacy TBB has priorities only for enqueued (FIFO) tasks.
+    void spawn(task_base& task, task_priority priority)
+    {
+        if (priority == priority_normal)
+        {
+            spawn(task);
+            return;
+        }
+
+        tbb::task::enqueue(*new (tbb::task::allocate_root()) carrier(task),
+                priority == priority_high ? tbb::priority_high : tbb::priority_low);
+    }
+
+    unsigned int concurrency() const
+    {
+        return tbb::task_scheduler_init::default_num_threads();
+    }
+
+    // The joining thread waits on a private root task with one extra
+    // reference, which finish_help() drops.
+    void prepare_help(help_state& state)
+    {
+        if (!state.mp_handle)
+            state.mp_handle = new (tbb::task::allocate_root()) tbb::empty_task;
+
+        root(state).set_ref_count(2);
+    }
+
+    void help(help_state& state)
+    {
+        root(state).wait_for_all();
+    }
+
+    void finish_help(help_state& state)
+    {
+        root(state).decrement_ref_count();
+    }
+
+    void release_help(help_state& state)
+    {
+        if (state.mp_handle)
+            tbb::task::destroy(root(state));
+
+        state.mp_handle = NULL;
+    }
+
+    static tbb_executor& instance()
+    {
+        static tbb_executor executor;
+        return executor;
+    }
+
+private:
+    class carrier : public tbb::task
+    {
+    public:
+        explicit carrier(task_base& task)
+                : mr_task(task)
+        {
+        }
+
+        tbb::task* execute()
+        {
+            mr_task.run();
+            return NULL;
+        }
+
+    private:
+        task_base& mr_task;
+    };
+
+    static tbb::empty_task& root(help_state& state)
+    {
+        return *static_cast<tbb::empty_task*>(state.mp_handle);
+    }
+};
+
+} // namespace cpp_utils
@@ -0,0 +1,108 @@
+/*    This file is part of cpp-utils
+ *    Copyright (c) 2010 Victor Vicente de Carvalho <victor.v.carvalho@gmail.com>
+ *
+ *    cpp-utils is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    cpp-utils is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with corvogame.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *    Cheap timestamps, for the hooks that take several per task
+ *    usage:
+ *
+ *   std::uint64_t start = cpp_utils::detail::ticks ( );
+ *   ...
+ *   double ns = ( cpp_utils::detail::ticks ( ) - start )
+ *           * cpp_utils::detail::tick_clock::instance ( ).ns_per_tick ( );
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace cpp_utils
+{
+
+namespace detail
+{
+
+// The TSC where there is one (a few nanoseconds to read), steady_clock
+// nanoseconds elsewhere.
+inline std::uint64_t ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+/*
+ * Rate of ticks(), measured against steady_clock from the first call to
+ * instance(). The measurement needs at least a millisecond to be
+ * accurate, so ns_per_tick() waits out whatever is left of the first one;
+ * touch instance() early to avoid that.
+ */
+class tick_clock
+{
+public:
+    typedef std::chrono::steady_clock clock;
+
+    double ns_per_tick() const
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        std::uint64_t now_ticks;
+        clock::duration elapsed;
+
+        do
+        {
+            now_ticks = ticks();
+            elapsed = clock::now() - m_start;
+        }
+        while (elapsed < std::chrono::milliseconds(1));
+
+        return double(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count())
+                / double(now_ticks - m_start_ticks);
+#else
+        return 1.0;
+#endif
+    }
+
+    // Never destroyed: pool threads may still take times during static
+    // destruction.
+    static tick_clock& instance()
+    {
+        static tick_clock* clock = new tick_clock;
+        return *clock;
+    }
+
+private:
+    tick_clock()
+            : m_start_ticks(ticks()), m_start(clock::now())
+    {
+    }
+
+    tick_clock(const tick_clock&);
+    tick_clock& operator=(const tick_clock&);
+
+    std::uint64_t m_start_ticks;
+    clock::time_point m_start;
+};
+
+} // namespace detail
+
+} // namespace cpp_utils
@@ -0,0 +1,555 @@
+/*    This file is part of cpp-utils
+ *    Copyright (c) 2010 Victor Vicente de Carvalho <victor.v.carvalho@gmail.com>
+ *
+ *    cpp-utils is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    cpp-utils is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with corvogame.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *    Task lifecycle tracing
+ *    usage:
+ *
+ *   //build everything with -DCPP_UTILS_TRACE; without it the hooks are
+ *   //not compiled in at all and tasks carry no extra fields
+ *
+ *   {
+ *       cpp_utils::trace::label_scope label ( "parse" );  //tasks spawned here,
+ *       cpp_utils::parallel ( synch, parse, chunk );       //and their children,
+ *   }                                                      //are labelled "parse"
+ *
+ *   std::vector<cpp_utils::trace::event> events = cpp_utils::trace::snapshot ();
+ *
+ *   //timeline for chrome://tracing or ui.perfetto.dev, one track per thread:
+ *   cpp_utils::trace::dump ( "tasks.json" );
+ *
+ *   Every task records spawn, start and finish; every wait_for_all and
+ *   wait_until records the start and end of the join. An event is a
+ *   timestamp, an id, the label and the thread's trace number, written to
+ *   a ring buffer owned by the recording thread: no locks, no atomic
+ *   read-modify-write, one release store. Each ring keeps the last
+ *   CPP_UTILS_TRACE_CAPACITY events written to it. A thread's ring goes
+ *   back to a free list when the thread exits and is taken over by the
+ *   next new thread, which carries on writing after the events already
+ *   there; so there are never more rings than threads alive at once, and
+ *   what an exited thread recorded stays visible until it is written over.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "ticks.hpp"
+
+// Events kept per thread; a power of two.
+#ifndef CPP_UTILS_TRACE_CAPACITY
+#define CPP_UTILS_TRACE_CAPACITY 65536
+#endif
+
+namespace cpp_utils
+{
+
+namespace trace
+{
+
+enum event_kind
+{
+    task_spawn, task_start, task_finish, join_begin, join_end
+};
+
+/*
+ * For task events m_id is unique per task within the process, so a spawn
+ * can be matched with its start; for joins it is the group's address.
+ * m_time is in clock ticks, see to_nanoseconds.
+ */
+struct event
+{
+    std::uint64_t m_time;
+    std::uint64_t m_id;
+    const char* mp_label;
+    std::uint32_t m_kind;
+    std::uint32_t m_thread;
+};
+
+namespace detail
+{
+
+using cpp_utils::detail::ticks;
+
+/*
+ * Events of one thread. Only the owner writes; readers copy the ring and
+ * then drop whatever the owner may have overwritten meanwhile, judging by
+ * the head before and after the copy.
+ */
+class ring
+{
+public:
+    explicit ring(std::uint32_t thread)
+            : m_head(0), m_thread(thread), m_next_id(0)
+    {
+    }
+
+    // For the thread taking over a ring whose owner has exited.
+    void adopt(std::uint32_t thread)
+    {
+        m_thread = thread;
+        m_next_id = 0;
+    }
+
+    void record(event_kind kind, std::uint64_t id, const char* label)
+    {
+        std::uint64_t head = m_head.load(std::memory_order_relaxed);
+        event& slot = m_events[head & mask];
+
+        slot.m_time = ticks();
+        slot.m_id = id;
+        slot.mp_label = label;
+        slot.m_kind = kind;
+        slot.m_thread = m_thread;
+
+        m_head.store(head + 1, std::memory_order_release);
+    }
+
+    // Thread number in the top bits keeps ids unique without a shared counter.
+    std::uint64_t next_id()
+    {
+        return (std::uint64_t(m_thread) << 40) | ++m_next_id;
+    }
+
+    void collect(std::vector<event>& out) const
+    {
+        std::uint64_t head = m_head.load(std::memory_order_acquire);
+        std::uint64_t first = head > capacity ? head - capacity : 0;
+        std::size_t start = out.size();
+
+        for (std::uint64_t i = first; i < head; ++i)
+            out.push_back(m_events[i & mask]);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        // The slot of the event being written now is the oldest one kept.
+        std::uint64_t after = m_head.load(std::memory_order_relaxed) + 1;
+        std::uint64_t valid = after > capacity ? after - capacity : 0;
+
+        if (valid > first)
+            out.erase(out.begin() + start, out.begin() + start + std::size_t(std::min(valid, head) - first));
+    }
+
+private:
+    enum { capacity = CPP_UTILS_TRACE_CAPACITY, mask = capacity - 1 };
+
+    static_assert((capacity & mask) == 0, "CPP_UTILS_TRACE_CAPACITY must be a power of two");
+
+    std::atomic<std::uint64_t> m_head;
+    std::uint32_t m_thread;
+    std::uint64_t m_next_id;
+    event m_events[capacity];
+};
+
+/*
+ * Every ring created, and those whose thread has exited. Rings are kept
+ * after their thread is gone so that a snapshot still sees what it
+ * recorded, and reused so that thread churn does not add rings. Also holds
+ * the tick reading taken at the first event, which event times are counted
+ * from.
+ */
+class registry
+{
+public:
+    registry()
+            : m_threads(0), m_start_ticks(ticks())
+    {
+        cpp_utils::detail::tick_clock::instance();
+    }
+
+    // Trace numbers are never reused, even when rings are.
+    ring& acquire()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::uint32_t thread = ++m_threads;
+
+        if (!m_free.empty())
+        {
+            ring* reused = m_free.back();
+            m_free.pop_back();
+            reused->adopt(thread);
+            return *reused;
+        }
+
+        m_rings.push_back(std::unique_ptr<ring>(new ring(thread)));
+        return *m_rings.back();
+    }
+
+    void release(ring& r)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_free.push_back(&r);
+    }
+
+    std::vector<event> snapshot()
+    {
+        std::vector<event> events;
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        for (std::size_t i = 0; i < m_rings.size(); ++i)
+            m_rings[i]->collect(events);
+
+        return events;
+    }
+
+    // Converts event times to nanoseconds since the first event.
+    class time_scale
+    {
+    public:
+        time_scale(std::uint64_t start, double ns_per_tick)
+                : m_start(start), m_ns_per_tick(ns_per_tick)
+        {
+        }
+
+        std::uint64_t operator()(std::uint64_t time) const
+        {
+            return time > m_start ? std::uint64_t(double(time - m_start) * m_ns_per_tick) : 0;
+        }
+
+    private:
+        std::uint64_t m_start;
+        double m_ns_per_tick;
+    };
+
+    time_scale scale()
+    {
+        return time_scale(m_start_ticks, cpp_utils::detail::tick_clock::instance().ns_per_tick());
+    }
+
+    // Never destroyed: pool threads may still record during static
+    // destruction.
+    static registry& instance()
+    {
+        static registry* rings = new registry;
+        return *rings;
+    }
+
+private:
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<ring> > m_rings;
+    std::vector<ring*> m_free;
+    std::uint32_t m_threads;
+    std::uint64_t m_start_ticks;
+};
+
+// Trivially destructible, so that events recorded during thread exit,
+// after the release below, find it closed and are dropped.
+struct local_slot
+{
+    ring* mp_ring;
+    bool m_closed;
+};
+
+struct release_at_exit
+{
+    ~release_at_exit();
+};
+
+inline local_slot& local()
+{
+    static thread_local local_slot slot;
+    return slot;
+}
+
+inline release_at_exit::~release_at_exit()
+{
+    local_slot& slot = local();
+
+    slot.m_closed = true;
+    if (slot.mp_ring)
+        registry::instance().release(*slot.mp_ring);
+    slot.mp_ring = NULL;
+}
+
+// NULL once the calling thread has started exiting.
+inline ring* local_ring()
+{
+    local_slot& slot = local();
+
+    if (!slot.mp_ring && !slot.m_closed)
+    {
+        static thread_local release_at_exit release;
+        (void) release;
+        slot.mp_ring = &registry::instance().acquire();
+    }
+
+    return slot.mp_ring;
+}
+
+inline const char*& current_label()
+{
+    static thread_local const char* label = NULL;
+    return label;
+}
+
+// Hooks, called by task_base and synched_t.
+
+inline void on_spawn(std::uint64_t& id, const char*& label)
+{
+    ring* local = local_ring();
+
+    id = local ? local->next_id() : 0;
+    label = current_label();
+    if (local)
+        local->record(task_spawn, id, label);
+}
+
+// Brackets a task's run; the task's label is current while it runs, so
+// its children inherit it.
+class run_scope
+{
+public:
+    run_scope(std::uint64_t id, const char* label)
+            : m_id(id), mp_label(label), mp_outer(current_label())
+    {
+        if (ring* local = local_ring())
+            local->record(task_start, m_id, mp_label);
+        current_label() = mp_label;
+    }
+
+    ~run_scope()
+    {
+        current_label() = mp_outer;
+        if (ring* local = local_ring())
+            local->record(task_finish, m_id, mp_label);
+    }
+
+private:
+    run_scope(const run_scope&);
+    run_scope& operator=(const run_scope&);
+
+    std::uint64_t m_id;
+    const char* mp_label;
+    const char* mp_outer;
+};
+
+class join_scope
+{
+public:
+    explicit join_scope(const void* group)
+            : m_id(reinterpret_cast<std::uintptr_t>(group))
+    {
+        if (ring* local = local_ring())
+            local->record(join_begin, m_id, current_label());
+    }
+
+    ~join_scope()
+    {
+        if (ring* local = local_ring())
+            local->record(join_end, m_id, current_label());
+    }
+
+private:
+    join_scope(const join_scope&);
+    join_scope& operator=(const join_scope&);
+
+    std::uint64_t m_id;
+};
+
+} // namespace detail
+
+/*
+ * Labels the tasks spawned by this thread while the scope lives. The
+ * string is stored by pointer, so it has to outlive the trace: a literal.
+ */
+class label_scope
+{
+public:
+    explicit label_scope(const char* label)
+            : mp_outer(detail::current_label())
+    {
+        detail::current_label() = label;
+    }
+
+    ~label_scope()
+    {
+        detail::current_label() = mp_outer;
+    }
+
+private:
+    label_scope(const label_scope&);
+    label_scope& operator=(const label_scope&);
+
+    const char* mp_outer;
+};
+
+// The events every thread still holds, thread by thread, each in order.
+inline std::vector<event> snapshot()
+{
+    return detail::registry::instance().snapshot();
+}
+
+// Nanoseconds from the first traced event to the given event time.
+inline std::uint64_t to_nanoseconds(std::uint64_t time)
+{
+    return detail::registry::instance().scale()(time);
+}
+
+namespace detail
+{
+
+inline void write_json_string(std::ostream& out, const char* text)
+{
+    out << '"';
+
+    for (; *text; ++text)
+    {
+        unsigned char c = static_cast<unsigned char>(*text);
+
+        if (c == '"' || c == '\\')
+            out << '\\' << char(c);
+        else if (c < 0x20)
+        {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out << escaped;
+        }
+        else
+            out << char(c);
+    }
+
+    out << '"';
+}
+
+// One Chrome trace event; times in nanoseconds, written as microseconds.
+inline void write_trace_event(std::ostream& out, bool& first, const char* phase, const char* name,
+        std::uint32_t thread, std::uint64_t ns, std::uint64_t duration_ns, std::uint64_t id)
+{
+    char times[64];
+
+    out << (first ? "\n" : ",\n") << "{\"ph\":\"" << phase << "\",\"name\":";
+    write_json_string(out, name);
+    out << ",\"pid\":1,\"tid\":" << thread;
+
+    std::snprintf(times, sizeof(times), ",\"ts\":%.3f", ns / 1000.0);
+    out << times;
+
+    if (phase[0] == 'X')
+    {
+        std::snprintf(times, sizeof(times), ",\"dur\":%.3f", duration_ns / 1000.0);
+        out << times << ",\"args\":{\"id\":" << id << "}";
+    }
+    else if (phase[0] == 's' || phase[0] == 'f')
+        out << ",\"cat\":\"spawn\",\"id\":" << id << (phase[0] == 'f' ? ",\"bp\":\"e\"" : "");
+
+    out << "}";
+    first = false;
+}
+
+} // namespace detail
+
+/*
+ * Writes what the rings hold as Chrome Trace Event JSON, for
+ * chrome://tracing or ui.perfetto.dev. Each trace thread is a track. Task
+ * runs and joins are slices, named after the label. Every spawn is a
+ * one-nanosecond "spawn" slice with a flow arrow to the run of the task it
+ * spawned. Runs whose start or finish has already been overwritten are
+ * left out. Returns false if the file could not be written.
+ */
+inline bool dump(const std::string& path)
+{
+    std::vector<event> events = snapshot();
+    detail::registry::time_scale scale = detail::registry::instance().scale();
+    std::ofstream out(path.c_str());
+
+    if (!out)
+        return false;
+
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+
+    bool first = true;
+    std::uint32_t thread = 0;
+    std::unordered_map<std::uint64_t, std::uint64_t> started;
+    std::vector<std::pair<std::uint64_t, std::uint64_t> > joins;
+
+    // snapshot() returns each thread's events together and in order.
+    for (std::size_t i = 0; i < events.size(); ++i)
+    {
+        const event& e = events[i];
+        std::uint64_t ns = scale(e.m_time);
+        const char* label = e.mp_label ? e.mp_label : "task";
+
+        if (e.m_thread != thread)
+        {
+            thread = e.m_thread;
+            started.clear();
+            joins.clear();
+
+            std::string name = "thread " + std::to_string(thread);
+            out << (first ? "\n" : ",\n") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << thread
+                    << ",\"args\":{\"name\":";
+            detail::write_json_string(out, name.c_str());
+            out << "}}";
+            first = false;
+        }
+
+        switch (e.m_kind)
+        {
+        case task_spawn:
+            detail::write_trace_event(out, first, "X", "spawn", thread, ns, 1, e.m_id);
+            detail::write_trace_event(out, first, "s", "spawn", thread, ns, 0, e.m_id);
+            break;
+
+        case task_start:
+            started[e.m_id] = ns;
+            detail::write_trace_event(out, first, "f", "spawn", thread, ns, 0, e.m_id);
+            break;
+
+        case task_finish:
+            if (started.count(e.m_id))
+            {
+                detail::write_trace_event(out, first, "X", label, thread, started[e.m_id], ns - started[e.m_id], e.m_id);
+                started.erase(e.m_id);
+            }
+            break;
+
+        case join_begin:
+            joins.push_back(std::make_pair(e.m_id, ns));
+            break;
+
+        case join_end:
+            if (!joins.empty() && joins.back().first == e.m_id)
+            {
+                detail::write_trace_event(out, first, "X", "join", thread, joins.back().second,
+                        ns - joins.back().second, e.m_id);
+                joins.pop_back();
+            }
+            break;
+        }
+    }
+
+    out << "\n]}\n";
+    out.close();
+    return bool(out);
+}
+
+} // namespace trace
+
+} // namespace cpp_utils